@@ -0,0 +1,138 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "harness.h"
+
+/* Usable bytes in a regular slab */
+#define SLAB_SIZE (64 * 1024)
+
+/* Granularity of block sizes, which is also the step between size classes */
+#define ARENA_ALIGN 16
+
+/*
+ * Number of size classes kept on free lists.
+ * Larger blocks get a dedicated slab, which is freed on recycle.
+ */
+#define ARENA_BINS 32
+#define ARENA_MAX_BIN_SIZE (ARENA_BINS * ARENA_ALIGN)
+
+typedef struct SLAB {
+    struct SLAB *next, *prev;
+    size_t size; /* Usable bytes in mem */
+    size_t used; /* Bytes already carved out of mem */
+    unsigned char mem[] __attribute__((aligned(ARENA_ALIGN)));
+} slab_t;
+
+struct ARENA {
+    slab_t *slabs; /* Slab currently being carved comes first */
+    void *bins[ARENA_BINS];
+};
+
+static size_t round_size(size_t size)
+{
+    return (size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+}
+
+/* Link slab s into the slab list, right after slab pos (or first if NULL) */
+static void slab_link(arena_t *a, slab_t *s, slab_t *pos)
+{
+    s->prev = pos;
+    s->next = pos ? pos->next : a->slabs;
+    if (s->next)
+        s->next->prev = s;
+    if (pos)
+        pos->next = s;
+    else
+        a->slabs = s;
+}
+
+static slab_t *slab_new(size_t size)
+{
+    slab_t *s = malloc(sizeof(slab_t) + size);
+    if (!s)
+        return NULL;
+
+    s->size = size;
+    s->used = 0;
+    return s;
+}
+
+arena_t *arena_new()
+{
+    arena_t *a = malloc(sizeof(arena_t));
+    if (!a)
+        return NULL;
+
+    memset(a, 0, sizeof(arena_t));
+    return a;
+}
+
+void *arena_alloc(arena_t *a, size_t size)
+{
+    size = round_size(size);
+
+    if (size > ARENA_MAX_BIN_SIZE) {
+        /* Keep the slab being carved at the front */
+        slab_t *s = slab_new(size);
+        if (!s)
+            return NULL;
+        s->used = size;
+        slab_link(a, s, a->slabs);
+        return s->mem;
+    }
+
+    void **bin = &a->bins[size / ARENA_ALIGN - 1];
+    if (*bin) {
+        void *p = *bin;
+        *bin = *(void **) p;
+        return p;
+    }
+
+    slab_t *s = a->slabs;
+    if (!s || s->size - s->used < size) {
+        s = slab_new(SLAB_SIZE);
+        if (!s)
+            return NULL;
+        slab_link(a, s, NULL);
+    }
+
+    void *p = s->mem + s->used;
+    s->used += size;
+    return p;
+}
+
+void arena_recycle(arena_t *a, void *p, size_t size)
+{
+    size = round_size(size);
+
+    if (size > ARENA_MAX_BIN_SIZE) {
+        /* Block owns its slab, so the slab can go right away */
+        slab_t *s = (slab_t *) ((unsigned char *) p - offsetof(slab_t, mem));
+        if (s->prev)
+            s->prev->next = s->next;
+        else
+            a->slabs = s->next;
+        if (s->next)
+            s->next->prev = s->prev;
+        free(s);
+        return;
+    }
+
+    void **bin = &a->bins[size / ARENA_ALIGN - 1];
+    *(void **) p = *bin;
+    *bin = p;
+}
+
+void arena_free(arena_t *a)
+{
+    if (!a)
+        return;
+
+    while (a->slabs) {
+        slab_t *s = a->slabs;
+        a->slabs = s->next;
+        free(s);
+    }
+    free(a);
+}
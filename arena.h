@@ -0,0 +1,42 @@
+#ifndef LAB0_ARENA_H
+#define LAB0_ARENA_H
+
+/*
+ * Slab allocator for blocks whose lifetime is bounded by their owner
+ * (e.g. a queue and its elements).
+ *
+ * Blocks are carved out of large slabs.  Released blocks are kept on
+ * per-size free lists and handed out again by later allocations.  All
+ * storage is returned at once by arena_free, which takes time
+ * proportional to the number of slabs rather than the number of blocks.
+ */
+
+#include <stddef.h>
+
+typedef struct ARENA arena_t;
+
+/*
+ * Create empty arena.
+ * Return NULL if could not allocate space.
+ */
+arena_t *arena_new();
+
+/*
+ * Allocate a block of size bytes from the arena.
+ * Return NULL if could not allocate space.
+ */
+void *arena_alloc(arena_t *a, size_t size);
+
+/*
+ * Give block p back to the arena for reuse.
+ * Argument size must match the one passed to arena_alloc.
+ */
+void arena_recycle(arena_t *a, void *p, size_t size);
+
+/*
+ * Free ALL storage used by the arena, including blocks still in use.
+ * No effect if a is NULL
+ */
+void arena_free(arena_t *a);
+
+#endif /* LAB0_ARENA_H */
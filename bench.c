@@ -0,0 +1,642 @@
+/* Benchmarks of the queues, single and multithreaded */
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Our program needs to use regular malloc/free */
+#define INTERNAL 1
+#include "harness.h"
+
+#include "bench.h"
+#include "msq.h"
+#include "queue.h"
+#include "report.h"
+#include "spsc.h"
+
+/* Longest string moved through the queues, including terminator */
+#define BENCH_STRLEN 32
+
+/*
+ * Latency histogram.
+ * Values below 8 ns get a bucket each.  Above that, every power of 2 is
+ * split into 8 buckets, so a bucket spans at most 1/8 of its lower bound.
+ */
+#define LAT_BUCKETS 512
+
+typedef struct {
+    uint64_t count[LAT_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+} latency_t;
+
+static int lat_bucket(uint64_t ns)
+{
+    if (ns < 8)
+        return ns;
+    int e = 63 - __builtin_clzll(ns);
+    return 8 + (e - 3) * 8 + (int) ((ns >> (e - 3)) - 8);
+}
+
+/* Smallest value falling into bucket b */
+static uint64_t lat_value(int b)
+{
+    if (b < 8)
+        return b;
+    int e = (b - 8) / 8 + 3;
+    return (uint64_t)(8 + (b - 8) % 8) << (e - 3);
+}
+
+static void lat_add(latency_t *l, uint64_t ns)
+{
+    l->count[lat_bucket(ns)]++;
+    l->total++;
+    if (ns > l->max)
+        l->max = ns;
+}
+
+static void lat_merge(latency_t *to, const latency_t *from)
+{
+    for (int b = 0; b < LAT_BUCKETS; b++)
+        to->count[b] += from->count[b];
+    to->total += from->total;
+    if (from->max > to->max)
+        to->max = from->max;
+}
+
+/* Value below which the given fraction of samples lie */
+static uint64_t lat_percentile(const latency_t *l, double fraction)
+{
+    uint64_t rank = (uint64_t)(fraction * l->total), seen = 0;
+    for (int b = 0; b < LAT_BUCKETS; b++) {
+        seen += l->count[b];
+        if (seen > rank)
+            return lat_value(b);
+    }
+    return l->max;
+}
+
+static void lat_report(const char *op, const latency_t *l)
+{
+    report(1,
+           "  %s latency: p50 %lu ns, p99 %lu ns, p99.9 %lu ns, max %lu ns",
+           op, (unsigned long) lat_percentile(l, 0.5),
+           (unsigned long) lat_percentile(l, 0.99),
+           (unsigned long) lat_percentile(l, 0.999), (unsigned long) l->max);
+}
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Start fn on each of the n threads, with arguments arg, arg + size, ...
+ * SIGALRM is blocked in them, leaving the time limit of qtest to the main
+ * thread.  Return number of threads started.
+ */
+static int start_threads(pthread_t *tid,
+                         int n,
+                         void *(*fn)(void *),
+                         void *arg,
+                         size_t size)
+{
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    int started = 0;
+    while (started < n &&
+           !pthread_create(&tid[started], NULL, fn,
+                           (char *) arg + started * size))
+        started++;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return started;
+}
+
+/*
+ * Benchmarks turn the checks of the harness down while timing.
+ * Blocks are freed far from where they were allocated, and checking each
+ * against every allocated block would dominate the timing.  Failing
+ * allocations on purpose would only leave strings missing.
+ */
+static int saved_fail_probability;
+
+static void harness_quiet()
+{
+    saved_fail_probability = fail_probability;
+    fail_probability = 0;
+    set_cautious_mode(false);
+}
+
+static void harness_restore()
+{
+    set_cautious_mode(true);
+    fail_probability = saved_fail_probability;
+}
+
+/*
+ * Multi-producer/multi-consumer benchmark.
+ * Producer i sends strings "i:0", "i:1", ... in order.  As the queues are
+ * FIFO, every consumer must see the strings of a producer in that order.
+ */
+
+typedef struct {
+    /* Lock-free queue, or if NULL, queue_t under lock */
+    msq_t *msq;
+    queue_t *q;
+    pthread_mutex_t lock;
+
+    int producers;
+    int count;
+    atomic_long total; /* Strings to be consumed */
+    atomic_long consumed;
+    atomic_long errors;
+    atomic_bool go; /* Set once all threads are running */
+} mpmc_t;
+
+typedef struct {
+    mpmc_t *m;
+    int id;
+    int *next; /* Of consumers, least sequence number due from each producer */
+    latency_t lat;
+} mpmc_worker_t;
+
+static bool mpmc_put(mpmc_t *m, msq_thread_t *h, const char *s)
+{
+    if (m->msq)
+        return msq_enqueue(h, s);
+
+    pthread_mutex_lock(&m->lock);
+    /* q_insert_tail takes a non-const string, but only copies it */
+    bool ok = q_insert_tail(m->q, (char *) s);
+    pthread_mutex_unlock(&m->lock);
+    return ok;
+}
+
+static bool mpmc_get(mpmc_t *m, msq_thread_t *h, char *buf)
+{
+    if (m->msq)
+        return msq_dequeue(h, buf, BENCH_STRLEN);
+
+    pthread_mutex_lock(&m->lock);
+    bool ok = q_remove_head(m->q, buf, BENCH_STRLEN);
+    pthread_mutex_unlock(&m->lock);
+    return ok;
+}
+
+static void *mpmc_producer(void *arg)
+{
+    mpmc_worker_t *w = arg;
+    mpmc_t *m = w->m;
+    msq_thread_t *h = m->msq ? msq_attach(m->msq) : NULL;
+    while (!atomic_load(&m->go))
+        sched_yield();
+
+    char buf[BENCH_STRLEN];
+    for (int k = 0; k < m->count; k++) {
+        snprintf(buf, sizeof(buf), "%d:%d", w->id, k);
+        uint64_t t0 = now_ns();
+        if (!mpmc_put(m, h, buf)) {
+            /* Do not keep consumers waiting for the rest */
+            atomic_fetch_sub(&m->total, m->count - k);
+            atomic_fetch_add(&m->errors, m->count - k);
+            break;
+        }
+        lat_add(&w->lat, now_ns() - t0);
+    }
+
+    msq_detach(h);
+    return NULL;
+}
+
+static void *mpmc_consumer(void *arg)
+{
+    mpmc_worker_t *w = arg;
+    mpmc_t *m = w->m;
+    msq_thread_t *h = m->msq ? msq_attach(m->msq) : NULL;
+    while (!atomic_load(&m->go))
+        sched_yield();
+
+    int *next = w->next;
+    char buf[BENCH_STRLEN];
+    while (atomic_load(&m->consumed) < atomic_load(&m->total)) {
+        uint64_t t0 = now_ns();
+        if (!mpmc_get(m, h, buf)) {
+            sched_yield();
+            continue;
+        }
+        lat_add(&w->lat, now_ns() - t0);
+        atomic_fetch_add(&m->consumed, 1);
+
+        char *end;
+        long id = strtol(buf, &end, 10);
+        long seq = *end == ':' ? strtol(end + 1, NULL, 10) : -1;
+        if (id < 0 || id >= m->producers || seq < next[id])
+            atomic_fetch_add(&m->errors, 1);
+        else
+            next[id] = seq + 1;
+    }
+
+    msq_detach(h);
+    return NULL;
+}
+
+/* Run one round of the benchmark and report it under name */
+static bool mpmc_run(mpmc_t *m, const char *name, int consumers)
+{
+    int n = m->producers + consumers;
+    pthread_t *tid = calloc_or_fail(n, sizeof(pthread_t), "mpmc_run");
+    mpmc_worker_t *w = calloc_or_fail(n, sizeof(mpmc_worker_t), "mpmc_run");
+    /* Allocated here, as report.c's allocation counters are not atomic */
+    int *next = calloc_or_fail(consumers * m->producers, sizeof(int),
+                               "mpmc_run");
+    for (int i = 0; i < n; i++) {
+        w[i].m = m;
+        w[i].id = i;
+        if (i >= m->producers)
+            w[i].next = next + (i - m->producers) * m->producers;
+    }
+    atomic_init(&m->consumed, 0);
+    atomic_init(&m->errors, 0);
+    atomic_init(&m->go, false);
+
+    int started = start_threads(tid, m->producers, mpmc_producer, w,
+                                sizeof(mpmc_worker_t));
+    if (started == m->producers)
+        started += start_threads(tid + started, consumers, mpmc_consumer,
+                                 w + started, sizeof(mpmc_worker_t));
+    bool ok = started == n;
+    if (!ok) {
+        /* Let the threads started already through, with nothing to do */
+        report(1, "ERROR: Could only start %d of %d threads", started, n);
+        m->count = 0;
+        atomic_store(&m->total, 0);
+    }
+
+    uint64_t t0 = now_ns();
+    atomic_store(&m->go, true);
+    for (int i = 0; i < started; i++)
+        pthread_join(tid[i], NULL);
+    double elapsed = (now_ns() - t0) / 1e9;
+
+    if (ok) {
+        latency_t put = {{0}}, get = {{0}};
+        for (int i = 0; i < m->producers; i++)
+            lat_merge(&put, &w[i].lat);
+        for (int i = m->producers; i < n; i++)
+            lat_merge(&get, &w[i].lat);
+        report(1, "%s: %ld strings in %.3f s, %.0f ops/sec", name,
+               atomic_load(&m->total), elapsed,
+               (put.total + get.total) / elapsed);
+        lat_report("enqueue", &put);
+        lat_report("dequeue", &get);
+
+        long errors = atomic_load(&m->errors);
+        if (errors) {
+            report(1, "ERROR: %ld strings missing or out of order", errors);
+            ok = false;
+        }
+    }
+
+    free_array(next, consumers * m->producers, sizeof(int));
+    free_array(w, n, sizeof(mpmc_worker_t));
+    free_array(tid, n, sizeof(pthread_t));
+    return ok;
+}
+
+bool bench_mpmc(int producers, int consumers, int count)
+{
+    size_t allocated = allocation_check();
+    mpmc_t m;
+    m.producers = producers;
+    m.count = count;
+    atomic_init(&m.total, (long) producers * count);
+    bool ok = true;
+
+    harness_quiet();
+
+    m.msq = msq_new();
+    if (!m.msq) {
+        report(1, "ERROR: Could not allocate lock-free queue");
+        ok = false;
+    } else {
+        ok = mpmc_run(&m, "lock-free", consumers);
+        msq_free(m.msq);
+        m.msq = NULL;
+    }
+
+    m.count = count;
+    atomic_init(&m.total, (long) producers * count);
+    m.q = q_new();
+    if (!m.q) {
+        report(1, "ERROR: Could not allocate queue");
+        ok = false;
+    } else {
+        pthread_mutex_init(&m.lock, NULL);
+        ok = mpmc_run(&m, "mutex", consumers) && ok;
+        pthread_mutex_destroy(&m.lock);
+        q_free(m.q);
+    }
+
+    harness_restore();
+
+    if (allocation_check() != allocated) {
+        report(1, "ERROR: Freed queues, but %lu blocks are still allocated",
+               (unsigned long) (allocation_check() - allocated));
+        ok = false;
+    }
+    return ok;
+}
+
+/*
+ * Single-producer/single-consumer benchmark.
+ * Each string carries its sequence number and the time it was pushed.
+ */
+
+/* Slots in the ring */
+#define SPSC_CAPACITY 1024
+
+typedef struct {
+    spsc_t *r;
+    int count;
+    int batch;
+    atomic_bool go; /* Set once both threads are running */
+    latency_t lat;  /* Of handoffs, as seen by the consumer */
+    long errors;
+} spsc_bench_t;
+
+static void *spsc_producer(void *arg)
+{
+    spsc_bench_t *b = arg;
+    char buf[SPSC_CAPACITY][BENCH_STRLEN];
+    const char *s[SPSC_CAPACITY];
+    while (!atomic_load(&b->go))
+        sched_yield();
+
+    for (int k = 0; k < b->count;) {
+        int n = b->count - k < b->batch ? b->count - k : b->batch;
+        uint64_t t = now_ns();
+        for (int i = 0; i < n; i++) {
+            snprintf(buf[i], BENCH_STRLEN, "%d:%lu", k + i, (unsigned long) t);
+            s[i] = buf[i];
+        }
+        for (int i = 0; i < n;) {
+            /* Wait for the consumer if the ring is full */
+            size_t done = spsc_push_bulk(b->r, s + i, n - i);
+            if (!done)
+                sched_yield();
+            i += done;
+        }
+        k += n;
+    }
+    return NULL;
+}
+
+static void *spsc_consumer(void *arg)
+{
+    spsc_bench_t *b = arg;
+    char buf[SPSC_CAPACITY][BENCH_STRLEN];
+    while (!atomic_load(&b->go))
+        sched_yield();
+
+    int next = 0;
+    while (next < b->count) {
+        size_t n = spsc_pop_bulk(b->r, buf[0], BENCH_STRLEN, b->batch);
+        if (!n) {
+            sched_yield();
+            continue;
+        }
+        uint64_t t = now_ns();
+        for (size_t i = 0; i < n; i++) {
+            char *end;
+            long seq = strtol(buf[i], &end, 10);
+            uint64_t sent = *end == ':' ? strtoull(end + 1, NULL, 10) : t;
+            lat_add(&b->lat, t - sent);
+            if (seq != next++)
+                b->errors++;
+        }
+    }
+    b->errors += b->count - next;
+    return NULL;
+}
+
+bool bench_spsc(int count, int batch)
+{
+    size_t allocated = allocation_check();
+    harness_quiet();
+
+    spsc_bench_t *b = calloc_or_fail(1, sizeof(spsc_bench_t), "bench_spsc");
+    b->r = spsc_new(SPSC_CAPACITY);
+    b->count = count;
+    b->batch = batch;
+    atomic_init(&b->go, false);
+    bool ok = b->r != NULL;
+    if (!ok)
+        report(1, "ERROR: Could not allocate ring");
+
+    pthread_t tid[2];
+    if (ok && start_threads(tid, 1, spsc_producer, b, 0) != 1) {
+        report(1, "ERROR: Could not start producer");
+        ok = false;
+    } else if (ok && start_threads(tid + 1, 1, spsc_consumer, b, 0) != 1) {
+        /* Let the producer go, with nothing to do */
+        report(1, "ERROR: Could not start consumer");
+        b->count = 0;
+        atomic_store(&b->go, true);
+        pthread_join(tid[0], NULL);
+        ok = false;
+    }
+
+    if (ok) {
+        uint64_t t0 = now_ns();
+        atomic_store(&b->go, true);
+        pthread_join(tid[0], NULL);
+        pthread_join(tid[1], NULL);
+        double elapsed = (now_ns() - t0) / 1e9;
+
+        report(1, "spsc: %d strings in batches of %d in %.3f s, %.0f ops/sec",
+               count, batch, elapsed, 2 * count / elapsed);
+        lat_report("handoff", &b->lat);
+        if (b->errors) {
+            report(1, "ERROR: %ld strings missing or out of order", b->errors);
+            ok = false;
+        }
+    }
+
+    spsc_free(b->r);
+    free_block(b, sizeof(spsc_bench_t));
+    harness_restore();
+
+    if (allocation_check() != allocated) {
+        report(1, "ERROR: Freed ring, but %lu blocks are still allocated",
+               (unsigned long) (allocation_check() - allocated));
+        ok = false;
+    }
+    return ok;
+}
+
+/*
+ * Interning benchmark.
+ * Strings look like host names, the i-th of them being number i % distinct.
+ */
+
+/* Passes over the queue when timing equality checks */
+#define INTERN_PASSES 10
+
+/* Count elements of q equal to its head, by contents or by pointer */
+static size_t count_equal(queue_t *q, bool by_pointer)
+{
+    q_iter_t it;
+    q_iter_init(q, &it);
+    char *head = q_iter_next(&it), *s;
+    size_t n = head != NULL;
+    while ((s = q_iter_next(&it)))
+        n += by_pointer ? s == head : !strcmp(s, head);
+    return n;
+}
+
+bool bench_intern(int count, int distinct)
+{
+    size_t allocated = allocation_check();
+    harness_quiet();
+
+    /* Index 0 holds copies, index 1 interned strings */
+    queue_t *q[2] = {NULL, NULL};
+    size_t bytes[2] = {0, 0}, equal[2] = {0, 0};
+    uint64_t ns[2] = {0, 0};
+    bool ok = true;
+    for (int mode = 0; ok && mode < 2; mode++) {
+        size_t before = allocation_bytes();
+        q[mode] = q_new();
+        ok = q[mode] && (!mode || q_set_intern(q[mode], true));
+        char buf[BENCH_STRLEN];
+        for (int i = 0; ok && i < count; i++) {
+            snprintf(buf, sizeof(buf), "host-%d.example.com", i % distinct);
+            ok = q_insert_tail(q[mode], buf);
+        }
+        bytes[mode] = allocation_bytes() - before;
+
+        uint64_t t0 = now_ns();
+        for (int pass = 0; ok && pass < INTERN_PASSES; pass++)
+            equal[mode] = count_equal(q[mode], mode);
+        ns[mode] = now_ns() - t0;
+    }
+    q_free(q[0]);
+    q_free(q[1]);
+    harness_restore();
+
+    if (!ok) {
+        report(1, "ERROR: Could not fill queues");
+    } else {
+        long saved = (long) bytes[0] - (long) bytes[1];
+        report(1, "copies: %zu bytes, interned: %zu bytes, saved %ld (%.1f%%)",
+               bytes[0], bytes[1], saved,
+               bytes[0] ? 100.0 * saved / bytes[0] : 0.0);
+        report(1, "equal to head: %zu, strcmp %.3f s, pointers %.3f s",
+               equal[0], ns[0] / 1e9, ns[1] / 1e9);
+        if (equal[0] != equal[1]) {
+            report(1, "ERROR: %zu strings equal to head, but %zu by pointer",
+                   equal[0], equal[1]);
+            ok = false;
+        }
+    }
+
+    if (allocation_check() != allocated) {
+        report(1, "ERROR: Freed queues, but %lu blocks are still allocated",
+               (unsigned long) (allocation_check() - allocated));
+        ok = false;
+    }
+    return ok;
+}
+
+/*
+ * Sorting benchmark.
+ * Both sorts get the same pseudo-random strings of lowercase letters, so
+ * their times are comparable from one run to the next.
+ */
+
+/* Shortest and longest strings sorted */
+#define SORT_MINLEN 5
+#define SORT_MAXLEN 20
+
+/* Fill q with count strings drawn from xorshift generator state *x */
+static bool fill_random(queue_t *q, int count, uint64_t *x)
+{
+    char buf[SORT_MAXLEN + 1];
+    for (int i = 0; i < count; i++) {
+        *x ^= *x << 13;
+        *x ^= *x >> 7;
+        *x ^= *x << 17;
+        uint64_t r = *x;
+        int len = SORT_MINLEN + r % (SORT_MAXLEN - SORT_MINLEN + 1);
+        for (int j = 0; j < len; j++) {
+            r = r * 6364136223846793005ULL + 1442695040888963407ULL;
+            buf[j] = 'a' + (r >> 33) % 26;
+        }
+        if (!q_insert_tail_n(q, buf, len))
+            return false;
+    }
+    return true;
+}
+
+/* Whether strings of q are in ascending order */
+static bool is_sorted(queue_t *q)
+{
+    q_iter_t it;
+    q_iter_init(q, &it);
+    char *prev = q_iter_next(&it), *s;
+    for (; (s = q_iter_next(&it)); prev = s)
+        if (strcmp(prev, s) > 0)
+            return false;
+    return true;
+}
+
+bool bench_sort(int count)
+{
+    static const q_sort_mode_t mode[] = {Q_SORT_MERGE, Q_SORT_ARRAY};
+    static const char *name[] = {"merge", "array"};
+    size_t allocated = allocation_check();
+    harness_quiet();
+
+    uint64_t ns[2] = {0, 0};
+    bool ok = true;
+    for (int m = 0; ok && m < 2; m++) {
+        /* One queue at a time, to leave room for large counts */
+        uint64_t x = 0x9e3779b97f4a7c15ULL;
+        queue_t *q = q_new();
+        ok = q && q_set_sort_mode(q, mode[m]) && fill_random(q, count, &x);
+        if (!ok) {
+            report(1, "ERROR: Could not fill queue");
+        } else {
+            uint64_t t0 = now_ns();
+            q_sort(q);
+            ns[m] = now_ns() - t0;
+            report(1, "%s: %.3f s, %zu comparisons, %zu past prefix", name[m],
+                   ns[m] / 1e9, q->sort_compares, q->sort_fallbacks);
+            if (q_size(q) != count || !is_sorted(q)) {
+                report(1, "ERROR: %s sort lost elements or order", name[m]);
+                ok = false;
+            }
+        }
+        q_free(q);
+    }
+    harness_restore();
+
+    if (ok && ns[1])
+        report(1, "array sort is %.2f times as fast", (double) ns[0] / ns[1]);
+    if (allocation_check() != allocated) {
+        report(1, "ERROR: Freed queues, but %lu blocks are still allocated",
+               (unsigned long) (allocation_check() - allocated));
+        ok = false;
+    }
+    return ok;
+}
@@ -0,0 +1,45 @@
+#ifndef LAB0_BENCH_H
+#define LAB0_BENCH_H
+
+/*
+ * Benchmarks of the queues, run by qtest.
+ * Results are printed through report().
+ */
+
+#include <stdbool.h>
+
+/*
+ * Move count strings from each of producers threads to consumers threads,
+ * once through the lock-free queue of msq.h and once through a queue_t
+ * guarded by a mutex.  Report throughput and latency of the operations.
+ * Return false if a thread could not be started, or strings went missing
+ * or arrived out of order.
+ */
+bool bench_mpmc(int producers, int consumers, int count);
+
+/*
+ * Hand count strings from a producer thread to a consumer thread through
+ * the ring of spsc.h, in batches of up to batch strings.  Report
+ * throughput and the time from push to pop.
+ * Return false if a thread could not be started, or strings went missing
+ * or arrived out of order.
+ */
+bool bench_spsc(int count, int batch);
+
+/*
+ * Fill a queue with count strings taking distinct different values, once
+ * as copies and once interned.  Report the memory taken each way, and the
+ * time to find the elements equal to the head by strcmp and by pointers.
+ * Return false if a queue could not be filled, or the two ways disagree.
+ */
+bool bench_intern(int count, int distinct);
+
+/*
+ * Sort the same count pseudo-random strings with the merge sort of linked
+ * elements, then with the sort of an array of pointers to them.  Report the
+ * time and comparisons each takes.
+ * Return false if a queue could not be filled, or was not sorted.
+ */
+bool bench_sort(int count);
+
+#endif /* LAB0_BENCH_H */
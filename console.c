@@ -103,6 +103,8 @@ void init_cmd()
               NULL);
     add_param("verbose", &verblevel, "Verbosity level", NULL);
     add_param("error", &err_limit, "Number of errors until exit", NULL);
+    add_param("mblimit", &mblimit, "Memory limit in megabytes (0 = unlimited)",
+              NULL);
     add_param("echo", (int *) &echo, "Do/don't echo commands", NULL);
 
     init_in();
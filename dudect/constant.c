@@ -22,7 +22,7 @@ const int drop_size = 20;
 static queue_t *q = NULL;
 static char random_string[NR_MEASURE][8];
 static int random_string_iter = 0;
-enum { test_insert_tail, test_size };
+enum { test_insert_tail, test_size, test_remove_tail, test_reverse };
 
 /* Implement the necessary queue interface to simulation */
 void init_dut(void)
@@ -57,7 +57,8 @@ void measure(int64_t *before_ticks,
              uint8_t *input_data,
              int mode)
 {
-    assert(mode == test_insert_tail || mode == test_size);
+    assert(mode == test_insert_tail || mode == test_size ||
+           mode == test_remove_tail || mode == test_reverse);
     if (mode == test_insert_tail) {
         for (size_t i = drop_size; i < number_measurements - drop_size; i++) {
             char *s = get_random_string();
@@ -70,6 +71,34 @@ void measure(int64_t *before_ticks,
             after_ticks[i] = cpucycles();
             dut_free();
         }
+    } else if (mode == test_remove_tail) {
+        /*
+         * Only the length of the queue should differ between classes, so
+         * the element removed and the one before it are always fresh ones
+         * rather than ones that may have left the cache.
+         */
+        for (size_t i = drop_size; i < number_measurements - drop_size; i++) {
+            dut_new();
+            dut_insert_head(
+                get_random_string(),
+                *(uint16_t *) (input_data + i * chunk_size) % 10000);
+            dut_insert_tail(get_random_string(), 2);
+            before_ticks[i] = cpucycles();
+            dut_remove_tail();
+            after_ticks[i] = cpucycles();
+            dut_free();
+        }
+    } else if (mode == test_reverse) {
+        for (size_t i = drop_size; i < number_measurements - drop_size; i++) {
+            dut_new();
+            dut_insert_head(
+                get_random_string(),
+                *(uint16_t *) (input_data + i * chunk_size) % 10000);
+            before_ticks[i] = cpucycles();
+            dut_reverse();
+            after_ticks[i] = cpucycles();
+            dut_free();
+        }
     } else {
         for (size_t i = drop_size; i < number_measurements - drop_size; i++) {
             dut_new();
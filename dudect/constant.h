@@ -24,6 +24,10 @@
             q_insert_tail(q, s); \
     } while (0)
 
+#define dut_remove_tail() ((void) (q_remove_tail(q, NULL, 0)))
+
+#define dut_reverse() ((void) (q_reverse(q)))
+
 #define dut_free() ((void) (q_free(q)))
 
 void init_dut();
@@ -153,19 +153,19 @@ static void init_once(void)
     t_init(t);
 }
 
-bool is_insert_tail_const(void)
+static bool test_const(char *name, int mode)
 {
     bool result = false;
     t = malloc(sizeof(t_ctx));
 
     for (int cnt = 0; cnt < test_tries; ++cnt) {
-        printf("Testing insert_tail...(%d/%d)\n\n", cnt, test_tries);
+        printf("Testing %s...(%d/%d)\n\n", name, cnt, test_tries);
         init_once();
         for (int i = 0;
              i <
              enough_measurements / (number_measurements - drop_size * 2) + 1;
              ++i)
-            result = doit(0);
+            result = doit(mode);
         printf("\033[A\033[2K\033[A\033[2K");
         if (result == true)
             break;
@@ -174,22 +174,22 @@ bool is_insert_tail_const(void)
     return result;
 }
 
+bool is_insert_tail_const(void)
+{
+    return test_const("insert_tail", 0);
+}
+
 bool is_size_const(void)
 {
-    bool result = false;
-    t = malloc(sizeof(t_ctx));
-    for (int cnt = 0; cnt < test_tries; ++cnt) {
-        printf("Testing size...(%d/%d)\n\n", cnt, test_tries);
-        init_once();
-        for (int i = 0;
-             i <
-             enough_measurements / (number_measurements - drop_size * 2) + 1;
-             ++i)
-            result = doit(1);
-        printf("\033[A\033[2K\033[A\033[2K");
-        if (result == true)
-            break;
-    }
-    free(t);
-    return result;
+    return test_const("size", 1);
+}
+
+bool is_remove_tail_const(void)
+{
+    return test_const("remove_tail", 2);
+}
+
+bool is_reverse_const(void)
+{
+    return test_const("reverse", 3);
 }
@@ -7,5 +7,7 @@
 /* Interface to test if function is constant */
 bool is_insert_tail_const(void);
 bool is_size_const(void);
+bool is_remove_tail_const(void);
+bool is_reverse_const(void);
 
 #endif
@@ -1,5 +1,6 @@
 /* Test support code */
 
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdio.h>
@@ -36,6 +37,7 @@
 typedef struct BELE {
     struct BELE *next, *prev;
     size_t payload_size;
+    bool watched;        /* Marked by watch_block */
     size_t magic_header; /* Marker to see if block seems legitimate */
     unsigned char payload[0];
     /* Also place magic number at tail of every block */
@@ -43,6 +45,40 @@ typedef struct BELE {
 
 static block_ele_t *allocated = NULL;
 static size_t allocated_count = 0;
+static size_t allocated_bytes = 0;
+/* Most allocated_bytes since allocation_peak was last called */
+static size_t peak_bytes = 0;
+static size_t watched_count = 0;
+static size_t watched_free_count = 0;
+/* Guards the list above, as queue code may allocate from several threads */
+static pthread_mutex_t allocated_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Set while this thread is within a section locked by allocated_lock.
+ * The handler of the time limit jumps away, which there would leave the
+ * lock taken and the list half updated, so trigger_exception instead
+ * leaves its message in deferred_message, for the end of the section.
+ */
+static __thread volatile sig_atomic_t in_allocated = 0;
+static __thread char *volatile deferred_message = NULL;
+
+static void lock_allocated()
+{
+    in_allocated = 1;
+    pthread_mutex_lock(&allocated_lock);
+}
+
+/* Release allocated_lock, then raise any exception held back meanwhile */
+static void unlock_allocated()
+{
+    pthread_mutex_unlock(&allocated_lock);
+    in_allocated = 0;
+    char *msg = deferred_message;
+    if (msg) {
+        deferred_message = NULL;
+        trigger_exception(msg);
+    }
+}
 
 /* Percent probability of malloc failure */
 int fail_probability = 0;
@@ -122,13 +158,10 @@ static size_t *find_footer(block_ele_t *b)
 /*
  * Implementation of application functions
  */
-void *test_malloc(size_t size)
-{
-    if (noallocate_mode) {
-        report_event(MSG_FATAL, "Calls to malloc disallowed");
-        return NULL;
-    }
 
+/* Allocate a checked block, whatever the allocation mode */
+static void *block_alloc(size_t size)
+{
     if (fail_allocation()) {
         report_event(MSG_WARN, "Malloc returning NULL");
         return NULL;
@@ -145,9 +178,11 @@ void *test_malloc(size_t size)
     new_block->magic_header = MAGICHEADER;
     // cppcheck-suppress nullPointerRedundantCheck
     new_block->payload_size = size;
+    new_block->watched = false;
     *find_footer(new_block) = MAGICFOOTER;
     void *p = (void *) &new_block->payload;
     memset(p, FILLCHAR, size);
+    lock_allocated();
     // cppcheck-suppress nullPointerRedundantCheck
     new_block->next = allocated;
     // cppcheck-suppress nullPointerRedundantCheck
@@ -157,10 +192,28 @@ void *test_malloc(size_t size)
         allocated->prev = new_block;
     allocated = new_block;
     allocated_count++;
+    allocated_bytes += size;
+    if (allocated_bytes > peak_bytes)
+        peak_bytes = allocated_bytes;
+    unlock_allocated();
 
     return p;
 }
 
+void *test_malloc(size_t size)
+{
+    if (noallocate_mode) {
+        report_event(MSG_FATAL, "Calls to malloc disallowed");
+        return NULL;
+    }
+    return block_alloc(size);
+}
+
+void *scratch_malloc(size_t size)
+{
+    return block_alloc(size);
+}
+
 // cppcheck-suppress unusedFunction
 void *test_calloc(size_t nelem, size_t elsize)
 {
@@ -173,16 +226,13 @@ void *test_calloc(size_t nelem, size_t elsize)
     return ptr;
 }
 
-void test_free(void *p)
+/* Free a block from block_alloc, whatever the allocation mode */
+static void block_free(void *p)
 {
-    if (noallocate_mode) {
-        report_event(MSG_FATAL, "Calls to free disallowed");
-        return;
-    }
-
     if (!p)
         return;
 
+    lock_allocated();
     block_ele_t *b = find_header(p);
     size_t footer = *find_footer(b);
     if (footer != MAGICFOOTER) {
@@ -205,9 +255,29 @@ void test_free(void *p)
         allocated = bn;
     if (bn)
         bn->prev = bp;
-
-    free(b);
     allocated_count--;
+    allocated_bytes -= b->payload_size;
+    if (b->watched) {
+        watched_count--;
+        watched_free_count++;
+    }
+    /* Before any exception held back is raised, lest the block leak */
+    free(b);
+    unlock_allocated();
+}
+
+void test_free(void *p)
+{
+    if (noallocate_mode) {
+        report_event(MSG_FATAL, "Calls to free disallowed");
+        return;
+    }
+    block_free(p);
+}
+
+void scratch_free(void *p)
+{
+    block_free(p);
 }
 
 // cppcheck-suppress unusedFunction
@@ -223,7 +293,59 @@ char *test_strdup(const char *s)
 
 size_t allocation_check()
 {
-    return allocated_count;
+    lock_allocated();
+    size_t count = allocated_count;
+    unlock_allocated();
+    return count;
+}
+
+size_t allocation_bytes()
+{
+    lock_allocated();
+    size_t bytes = allocated_bytes;
+    unlock_allocated();
+    return bytes;
+}
+
+size_t allocation_peak()
+{
+    lock_allocated();
+    size_t bytes = peak_bytes;
+    peak_bytes = allocated_bytes;
+    unlock_allocated();
+    return bytes;
+}
+
+bool watch_block(void *p)
+{
+    block_ele_t *b = (block_ele_t *) ((size_t) p - sizeof(block_ele_t));
+    bool found = false;
+
+    lock_allocated();
+    for (block_ele_t *ab = allocated; ab && !found; ab = ab->next)
+        found = ab == b;
+    if (found && !b->watched) {
+        b->watched = true;
+        watched_count++;
+    }
+    unlock_allocated();
+    return found;
+}
+
+size_t watched_allocated()
+{
+    lock_allocated();
+    size_t count = watched_count;
+    unlock_allocated();
+    return count;
+}
+
+size_t watched_freed()
+{
+    lock_allocated();
+    size_t count = watched_free_count;
+    unlock_allocated();
+    return count;
 }
 
 /*
@@ -306,6 +428,10 @@ void exception_cancel()
  */
 void trigger_exception(char *msg)
 {
+    if (in_allocated) {
+        deferred_message = msg;
+        return;
+    }
     error_occurred = true;
     error_message = msg;
     if (jmp_ready)
@@ -17,11 +17,39 @@ void test_free(void *p);
 char *test_strdup(const char *s);
 /* FIXME: provide test_realloc as well */
 
+/*
+ * Allocate/free scratch space held only for the length of one operation,
+ * such as an index built by a sort.  Blocks are checked like those of
+ * malloc and free, but are allowed in restricted allocation mode, so that
+ * the operation can still be checked not to allocate or free elements.
+ */
+void *scratch_malloc(size_t size);
+void scratch_free(void *p);
+
 #ifdef INTERNAL
 
 /* Report number of allocated blocks */
 size_t allocation_check();
 
+/* Report number of bytes requested by the allocated blocks */
+size_t allocation_bytes();
+
+/*
+ * Report the most bytes requested by allocated blocks at any one time since
+ * the last call, and start over from the number currently allocated.
+ */
+size_t allocation_peak();
+
+/*
+ * Mark block p, so that the harness counts when it gets freed.
+ * Return false if p is not currently allocated.
+ */
+bool watch_block(void *p);
+
+/* Report number of marked blocks still allocated, and freed so far */
+size_t watched_allocated();
+size_t watched_freed();
+
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
@@ -0,0 +1,138 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+#include "intern.h"
+
+/* Buckets in a new table.  It doubles whenever entries outnumber them. */
+#define INTERN_MIN_BUCKETS 64
+
+typedef struct ENTRY {
+    struct ENTRY *next; /* In the same bucket */
+    size_t refs;
+    uint64_t hash;
+    size_t length;
+    char str[];
+} entry_t;
+
+struct INTERN {
+    entry_t **bucket;
+    size_t mask; /* Number of buckets - 1 */
+    size_t count;
+};
+
+/* 64-bit FNV-1a */
+static uint64_t hash_str(const char *s, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) s[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/* Allocate n empty buckets */
+static entry_t **bucket_new(size_t n)
+{
+    entry_t **bucket = malloc(n * sizeof(entry_t *));
+    if (bucket)
+        memset(bucket, 0, n * sizeof(entry_t *));
+    return bucket;
+}
+
+intern_t *intern_new()
+{
+    intern_t *t = malloc(sizeof(intern_t));
+    if (!t)
+        return NULL;
+
+    t->bucket = bucket_new(INTERN_MIN_BUCKETS);
+    if (!t->bucket) {
+        free(t);
+        return NULL;
+    }
+    t->mask = INTERN_MIN_BUCKETS - 1;
+    t->count = 0;
+    return t;
+}
+
+/* Double the number of buckets.  Keep the old ones if out of space. */
+static void grow(intern_t *t)
+{
+    size_t n = (t->mask + 1) * 2;
+    entry_t **bucket = bucket_new(n);
+    if (!bucket)
+        return;
+
+    for (size_t i = 0; i <= t->mask; i++) {
+        entry_t *e = t->bucket[i];
+        while (e) {
+            entry_t *next = e->next;
+            e->next = bucket[e->hash & (n - 1)];
+            bucket[e->hash & (n - 1)] = e;
+            e = next;
+        }
+    }
+    free(t->bucket);
+    t->bucket = bucket;
+    t->mask = n - 1;
+}
+
+char *intern_get(intern_t *t, const char *s, size_t len)
+{
+    uint64_t h = hash_str(s, len);
+    for (entry_t *e = t->bucket[h & t->mask]; e; e = e->next) {
+        if (e->hash == h && e->length == len && !memcmp(e->str, s, len)) {
+            e->refs++;
+            return e->str;
+        }
+    }
+
+    entry_t *e = malloc(sizeof(entry_t) + len + 1);
+    if (!e)
+        return NULL;
+
+    memcpy(e->str, s, len);
+    e->str[len] = '\0';
+    e->refs = 1;
+    e->hash = h;
+    e->length = len;
+    e->next = t->bucket[h & t->mask];
+    t->bucket[h & t->mask] = e;
+    if (++t->count > t->mask + 1)
+        grow(t);
+    return e->str;
+}
+
+void intern_put(intern_t *t, char *s)
+{
+    entry_t *e = (entry_t *) (s - offsetof(entry_t, str));
+    if (--e->refs)
+        return;
+
+    entry_t **p = &t->bucket[e->hash & t->mask];
+    while (*p != e)
+        p = &(*p)->next;
+    *p = e->next;
+    t->count--;
+    free(e);
+}
+
+void intern_free(intern_t *t)
+{
+    if (!t)
+        return;
+
+    for (size_t i = 0; i <= t->mask; i++) {
+        entry_t *e = t->bucket[i];
+        while (e) {
+            entry_t *next = e->next;
+            free(e);
+            e = next;
+        }
+    }
+    free(t->bucket);
+    free(t);
+}
@@ -0,0 +1,39 @@
+#ifndef LAB0_INTERN_H
+#define LAB0_INTERN_H
+
+/*
+ * Table of shared copies of strings.
+ *
+ * Equal strings interned in the same table get one reference counted
+ * buffer, so they take the space of a single copy and can be told equal
+ * by comparing pointers.  Buffers are found by hashing their contents and
+ * are freed once their last reference is dropped.
+ */
+
+#include <stddef.h>
+
+typedef struct INTERN intern_t;
+
+/*
+ * Create empty table.
+ * Return NULL if could not allocate space.
+ */
+intern_t *intern_new();
+
+/*
+ * Return the shared copy of the first len bytes of string s, with a null
+ * terminator, adding a reference to it.
+ * Return NULL if could not allocate space.
+ */
+char *intern_get(intern_t *t, const char *s, size_t len);
+
+/* Drop a reference to string s, obtained from intern_get on t */
+void intern_put(intern_t *t, char *s);
+
+/*
+ * Free ALL storage used by the table, including strings still referenced.
+ * No effect if t is NULL
+ */
+void intern_free(intern_t *t);
+
+#endif /* LAB0_INTERN_H */
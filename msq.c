@@ -0,0 +1,267 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Nodes come and go with every operation, from many threads at once, so
+ * they are taken from the C library rather than the harness, whose
+ * allocations all go through one lock.  The queue and thread records are
+ * allocated once, through the harness, which checks they are freed.
+ */
+#define INTERNAL 1
+#include "harness.h"
+#include "msq.h"
+
+/* Size of a cache line, to keep head and tail from sharing one */
+#define CACHE_LINE 64
+
+/* Hazard pointers held by each thread: the head or tail, and its next */
+#define MSQ_HAZARDS 2
+
+/*
+ * Retired nodes a thread keeps before trying to free them.  This is twice
+ * the most hazard pointers there can be, so each scan frees at least half.
+ */
+#define MSQ_RETIRE_MAX (2 * MSQ_HAZARDS * MSQ_MAX_THREADS)
+
+typedef struct MSQ_NODE {
+    _Atomic(struct MSQ_NODE *) next;
+    char value[];
+} msq_node_t;
+
+struct MSQ_THREAD {
+    _Atomic(msq_node_t *) hazard[MSQ_HAZARDS];
+    atomic_bool in_use;
+    msq_t *q;
+    /* Nodes removed from the queue but possibly still read by others */
+    int nretired;
+    msq_node_t *retired[MSQ_RETIRE_MAX];
+};
+
+struct MSQ {
+    _Atomic(msq_node_t *) head; /* Dummy node, followed by the elements */
+    char pad_head[CACHE_LINE - sizeof(msq_node_t *)];
+    _Atomic(msq_node_t *) tail; /* Last node, or lagging one behind */
+    char pad_tail[CACHE_LINE - sizeof(msq_node_t *)];
+    /* Records of threads ever attached; slots are filled from the front */
+    _Atomic(msq_thread_t *) rec[MSQ_MAX_THREADS];
+};
+
+/* Allocate a node holding a copy of string s */
+static msq_node_t *node_new(const char *s)
+{
+    size_t length = strlen(s) + 1;
+    msq_node_t *n = malloc(sizeof(msq_node_t) + length);
+    if (!n)
+        return NULL;
+
+    atomic_init(&n->next, NULL);
+    memcpy(n->value, s, length);
+    return n;
+}
+
+msq_t *msq_new()
+{
+    msq_t *q = test_malloc(sizeof(msq_t));
+    if (!q)
+        return NULL;
+
+    msq_node_t *dummy = node_new("");
+    if (!dummy) {
+        test_free(q);
+        return NULL;
+    }
+    atomic_init(&q->head, dummy);
+    atomic_init(&q->tail, dummy);
+    for (int i = 0; i < MSQ_MAX_THREADS; i++)
+        atomic_init(&q->rec[i], NULL);
+    return q;
+}
+
+void msq_free(msq_t *q)
+{
+    if (!q)
+        return;
+
+    msq_node_t *n = atomic_load(&q->head);
+    while (n) {
+        msq_node_t *next = atomic_load(&n->next);
+        free(n);
+        n = next;
+    }
+
+    for (int i = 0; i < MSQ_MAX_THREADS; i++) {
+        msq_thread_t *t = atomic_load(&q->rec[i]);
+        if (!t)
+            break;
+        for (int j = 0; j < t->nretired; j++)
+            free(t->retired[j]);
+        test_free(t);
+    }
+    test_free(q);
+}
+
+msq_thread_t *msq_attach(msq_t *q)
+{
+    if (!q)
+        return NULL;
+
+    for (int i = 0; i < MSQ_MAX_THREADS; i++) {
+        msq_thread_t *t = atomic_load(&q->rec[i]);
+        if (!t) {
+            /* Past the records in use so far; add one in this slot */
+            if (!(t = test_malloc(sizeof(msq_thread_t))))
+                return NULL;
+            for (int j = 0; j < MSQ_HAZARDS; j++)
+                atomic_init(&t->hazard[j], NULL);
+            atomic_init(&t->in_use, true);
+            t->q = q;
+            t->nretired = 0;
+
+            msq_thread_t *expected = NULL;
+            if (atomic_compare_exchange_strong(&q->rec[i], &expected, t))
+                return t;
+            /* Another thread took the slot first */
+            test_free(t);
+            t = expected;
+        }
+
+        bool idle = false;
+        if (atomic_compare_exchange_strong(&t->in_use, &idle, true))
+            return t;
+    }
+    return NULL;
+}
+
+/* Free those retired nodes of t that no thread holds a hazard pointer to */
+static void reclaim(msq_thread_t *t)
+{
+    msq_node_t *hazards[MSQ_HAZARDS * MSQ_MAX_THREADS];
+    int nhazards = 0;
+    for (int i = 0; i < MSQ_MAX_THREADS; i++) {
+        msq_thread_t *r = atomic_load(&t->q->rec[i]);
+        if (!r)
+            break;
+        for (int j = 0; j < MSQ_HAZARDS; j++) {
+            msq_node_t *h = atomic_load(&r->hazard[j]);
+            if (h)
+                hazards[nhazards++] = h;
+        }
+    }
+
+    int kept = 0;
+    for (int i = 0; i < t->nretired; i++) {
+        msq_node_t *n = t->retired[i];
+        bool hazardous = false;
+        for (int j = 0; j < nhazards && !hazardous; j++)
+            hazardous = hazards[j] == n;
+        if (hazardous)
+            t->retired[kept++] = n;
+        else
+            free(n);
+    }
+    t->nretired = kept;
+}
+
+void msq_detach(msq_thread_t *t)
+{
+    if (!t)
+        return;
+
+    for (int j = 0; j < MSQ_HAZARDS; j++)
+        atomic_store(&t->hazard[j], NULL);
+    /* Whatever is still hazardous is left to the next user of the record */
+    reclaim(t);
+    atomic_store(&t->in_use, false);
+}
+
+/*
+ * Load *src and publish it as hazard pointer h of thread t.
+ * Loop until the pointer is still in place after publication, at which
+ * point any thread retiring it will see the hazard.
+ */
+static msq_node_t *protect(msq_thread_t *t,
+                           int h,
+                           _Atomic(msq_node_t *) *src)
+{
+    msq_node_t *n = atomic_load(src);
+    for (;;) {
+        atomic_store(&t->hazard[h], n);
+        msq_node_t *again = atomic_load(src);
+        if (again == n)
+            return n;
+        n = again;
+    }
+}
+
+bool msq_enqueue(msq_thread_t *t, const char *s)
+{
+    if (!t)
+        return false;
+
+    msq_node_t *node = node_new(s);
+    if (!node)
+        return false;
+
+    msq_t *q = t->q;
+    for (;;) {
+        msq_node_t *tail = protect(t, 0, &q->tail);
+        msq_node_t *next = atomic_load(&tail->next);
+        if (tail != atomic_load(&q->tail))
+            continue;
+        if (next) {
+            /* Tail is lagging behind; help move it on */
+            atomic_compare_exchange_weak(&q->tail, &tail, next);
+            continue;
+        }
+        msq_node_t *expected = NULL;
+        if (atomic_compare_exchange_weak(&tail->next, &expected, node)) {
+            atomic_compare_exchange_strong(&q->tail, &tail, node);
+            break;
+        }
+    }
+    atomic_store(&t->hazard[0], NULL);
+    return true;
+}
+
+bool msq_dequeue(msq_thread_t *t, char *sp, size_t bufsize)
+{
+    if (!t)
+        return false;
+
+    msq_t *q = t->q;
+    msq_node_t *head, *next;
+    for (;;) {
+        head = protect(t, 0, &q->head);
+        msq_node_t *tail = atomic_load(&q->tail);
+        next = protect(t, 1, &head->next);
+        if (head != atomic_load(&q->head))
+            continue;
+        if (!next) {
+            atomic_store(&t->hazard[0], NULL);
+            atomic_store(&t->hazard[1], NULL);
+            return false;
+        }
+        if (head == tail) {
+            /* Tail is lagging behind; help move it on */
+            atomic_compare_exchange_weak(&q->tail, &tail, next);
+            continue;
+        }
+        if (atomic_compare_exchange_weak(&q->head, &head, next))
+            break;
+    }
+
+    /* next is the new dummy node, and is kept alive by hazard pointer 1 */
+    if (sp && bufsize) {
+        size_t length = strnlen(next->value, bufsize - 1);
+        memcpy(sp, next->value, length);
+        sp[length] = '\0';
+    }
+    atomic_store(&t->hazard[0], NULL);
+    atomic_store(&t->hazard[1], NULL);
+
+    t->retired[t->nretired++] = head;
+    if (t->nretired == MSQ_RETIRE_MAX)
+        reclaim(t);
+    return true;
+}
@@ -0,0 +1,61 @@
+#ifndef LAB0_MSQ_H
+#define LAB0_MSQ_H
+
+/*
+ * Lock-free multi-producer/multi-consumer queue of strings.
+ *
+ * This is the algorithm of Michael and Scott: a singly-linked list that
+ * always starts with a dummy node, with head and tail swung by
+ * compare-and-swap.  Removed nodes are reclaimed with hazard pointers, so
+ * a node is only freed once no thread can still be reading it.
+ *
+ * Each thread using a queue must first attach to it and use the returned
+ * handle for every operation.  A handle must not be shared by threads.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Most threads that can be attached to one queue at a time */
+#define MSQ_MAX_THREADS 64
+
+typedef struct MSQ msq_t;
+typedef struct MSQ_THREAD msq_thread_t;
+
+/*
+ * Create empty queue.
+ * Return NULL if could not allocate space.
+ */
+msq_t *msq_new();
+
+/*
+ * Free all storage used by queue, including the strings still in it.
+ * No thread may be using the queue any more.
+ */
+void msq_free(msq_t *q);
+
+/*
+ * Register the calling thread with the queue.
+ * Return NULL if MSQ_MAX_THREADS threads are attached already or could not
+ * allocate space.
+ */
+msq_thread_t *msq_attach(msq_t *q);
+
+/* Give up a handle returned by msq_attach */
+void msq_detach(msq_thread_t *t);
+
+/*
+ * Attempt to insert a copy of string s at tail of queue.
+ * Return false if could not allocate space.
+ */
+bool msq_enqueue(msq_thread_t *t, const char *s);
+
+/*
+ * Attempt to remove element from head of queue.
+ * Return false if queue is empty.
+ * If sp is non-NULL, the removed string is copied to *sp, as by
+ * q_remove_head.
+ */
+bool msq_dequeue(msq_thread_t *t, char *sp, size_t bufsize);
+
+#endif /* LAB0_MSQ_H */
@@ -1,5 +1,6 @@
 /* Implementation of testing code for queue code */
 
+#include <fcntl.h>
 #include <getopt.h>
 #include <signal.h>
 #include <spawn.h>
@@ -31,7 +32,9 @@
  */
 #include "queue.h"
 
+#include "bench.h"
 #include "console.h"
+#include "msq.h"
 #include "report.h"
 
 /* Settable parameters */
@@ -52,12 +55,52 @@ static queue_t *q = NULL;
 /* Number of elements in queue */
 static size_t qcnt = 0;
 
+/*
+ * Named queues, switched between by the use command.  The current one is
+ * worked on through q and qcnt above, and only stored back here when
+ * switching away from it.
+ */
+#define MAX_QUEUES 256
+#define QUEUE_NAME_LEN 32
+typedef struct {
+    char name[QUEUE_NAME_LEN];
+    queue_t *q;
+    size_t qcnt;
+} named_queue_t;
+static named_queue_t queues[MAX_QUEUES] = {{"main", NULL, 0}};
+static int nqueues = 1;
+static int cur_queue = 0;
+
 /* How many times can queue operations fail */
 static int fail_limit = BIG_QUEUE;
 static int fail_count = 0;
 
 static int string_length = MAXSTRING;
 
+/* Representation of new queues, as a q_backend_t */
+static int backend = Q_DEFAULT_BACKEND;
+
+/* Algorithm used by sort, as a q_sort_mode_t */
+static int sort_mode = Q_SORT_MERGE;
+
+/* Threads used by sort in parallel mode */
+static int sort_threads = Q_SORT_DEFAULT_THREADS;
+
+/* Scratch memory in KiB that xsort may take, within mblimit if set */
+static int sort_mem = 1024;
+
+/* Should new queues allocate their elements from an arena? */
+static int arena_mode = 0;
+
+/* Should new queues intern their strings? */
+static int intern_mode = 0;
+
+/* Should new queues count their strings in a hash index? */
+static int index_mode = 0;
+
+/* Number of strings handed over to queues by iht and itt */
+static size_t taken_count = 0;
+
 #define MIN_RANDSTR_LEN 5
 #define MAX_RANDSTR_LEN 10
 static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
@@ -68,15 +111,64 @@ static bool do_new(int argc, char *argv[]);
 static bool do_free(int argc, char *argv[]);
 static bool do_insert_head(int argc, char *argv[]);
 static bool do_insert_tail(int argc, char *argv[]);
+static bool do_insert_head_take(int argc, char *argv[]);
+static bool do_insert_tail_take(int argc, char *argv[]);
 static bool do_remove_head(int argc, char *argv[]);
 static bool do_remove_head_quiet(int argc, char *argv[]);
+static bool do_remove_tail(int argc, char *argv[]);
+static bool do_peek(int argc, char *argv[]);
+static bool do_remove_head_bulk(int argc, char *argv[]);
+static bool do_drain(int argc, char *argv[]);
 static bool do_reverse(int argc, char *argv[]);
 static bool do_size(int argc, char *argv[]);
 static bool do_sort(int argc, char *argv[]);
+static bool do_topk(int argc, char *argv[]);
+static bool do_nth(int argc, char *argv[]);
 static bool do_show(int argc, char *argv[]);
+static bool do_save(int argc, char *argv[]);
+static bool do_load(int argc, char *argv[]);
+static bool do_mapload(int argc, char *argv[]);
+static bool do_xsort(int argc, char *argv[]);
+static bool do_mpmc(int argc, char *argv[]);
+static bool do_spsc(int argc, char *argv[]);
+static bool do_intern(int argc, char *argv[]);
+static bool do_sortbench(int argc, char *argv[]);
+static bool do_use(int argc, char *argv[]);
+static bool do_merge(int argc, char *argv[]);
+static bool do_find(int argc, char *argv[]);
+static bool do_count(int argc, char *argv[]);
+static bool do_dedup(int argc, char *argv[]);
 
 static void queue_init();
 
+/*
+ * Return the index of the queue called name, adding a null one if there
+ * is none and add is set.
+ * Return -1 if not found, or could not be added.
+ */
+static int find_queue(const char *name, bool add)
+{
+    for (int i = 0; i < nqueues; i++)
+        if (!strcmp(queues[i].name, name))
+            return i;
+    if (!add || nqueues == MAX_QUEUES || strlen(name) >= QUEUE_NAME_LEN)
+        return -1;
+
+    memcpy(queues[nqueues].name, name, strlen(name) + 1);
+    queues[nqueues].q = NULL;
+    queues[nqueues].qcnt = 0;
+    return nqueues++;
+}
+
+/* Whether named queues other than the current one have been created */
+static bool other_queues_live()
+{
+    for (int i = 0; i < nqueues; i++)
+        if (i != cur_queue && queues[i].q)
+            return true;
+    return false;
+}
+
 static void console_init()
 {
     add_cmd("new", do_new, "                | Create new queue");
@@ -87,23 +179,103 @@ static void console_init()
     add_cmd("it", do_insert_tail,
             " str [n]        | Insert string str at tail of queue n times. "
             "Generate random string(s) if str equals RAND. (default: n == 1)");
+    add_cmd("iht", do_insert_head_take,
+            " str [n]        | Like ih, but hand over a heap string to the "
+            "queue instead of having it copied");
+    add_cmd("itt", do_insert_tail_take,
+            " str [n]        | Like it, but hand over a heap string to the "
+            "queue instead of having it copied");
     add_cmd("rh", do_remove_head,
             " [str]          | Remove from head of queue.  Optionally compare "
             "to expected value str");
     add_cmd(
         "rhq", do_remove_head_quiet,
         "                | Remove from head of queue without reporting value.");
+    add_cmd("rt", do_remove_tail,
+            " [str]          | Remove from tail of queue.  Optionally compare "
+            "to expected value str");
+    add_cmd("peek", do_peek,
+            "                | Show strings at head and tail of queue");
+    add_cmd("rhb", do_remove_head_bulk,
+            " [n]            | Remove n elements from head of queue at once, "
+            "taking their strings without copying (default: all)");
+    add_cmd("drain", do_drain,
+            " [n]            | Detach n elements from head of a list queue "
+            "as a chain (default: all)");
     add_cmd("reverse", do_reverse, "                | Reverse queue");
     add_cmd("sort", do_sort, "                | Sort queue in ascending order");
+    add_cmd("topk", do_topk,
+            " k              | Move k smallest elements to head of queue, in "
+            "ascending order");
+    add_cmd("nth", do_nth,
+            " k              | Find element that would be at index k if the "
+            "queue were sorted");
+    add_cmd("use", do_use,
+            " name           | Switch to queue called name, which starts out "
+            "as null (first queue: main)");
+    add_cmd("merge", do_merge,
+            " name ...       | Merge named sorted queues into this sorted "
+            "queue, leaving them empty");
+    add_cmd("find", do_find,
+            " str [n]        | Check n times whether queue holds str "
+            "(default: n == 1)");
+    add_cmd("count", do_count,
+            " str [n]        | Count elements holding str n times "
+            "(default: n == 1)");
+    add_cmd("dedup", do_dedup,
+            "                | Remove elements whose strings appear closer "
+            "to head of queue");
     add_cmd("size", do_size,
             " [n]            | Compute queue size n times (default: n == 1)");
     add_cmd("show", do_show, "                | Show queue contents");
+    add_cmd("save", do_save,
+            " file           | Save queue contents to file in binary form");
+    add_cmd("load", do_load,
+            " file           | Insert strings saved in file at tail of queue");
+    add_cmd("mapload", do_mapload,
+            " file           | Create read-only queue over strings saved in "
+            "file, and compare its memory use with loading a copy");
+    add_cmd("xsort", do_xsort,
+            " [file]         | Sort queue through temporary files within "
+            "sortmem KiB, or into file as by save, emptying queue");
+    add_cmd("mpmc", do_mpmc,
+            " p c [n]        | Move n strings from each of p producer threads "
+            "to c consumer threads, through lock-free and locked queues "
+            "(default: n == 100000)");
+    add_cmd("spsc", do_spsc,
+            " [n] [b]        | Hand n strings from one thread to another "
+            "through a ring, b at a time (default: n == 1000000, b == 1)");
+    add_cmd("intern", do_intern,
+            " [n] [d]        | Compare queues of n strings taking d values, "
+            "copied and interned (default: n == 100000, d == 100)");
+    add_cmd("sortbench", do_sortbench,
+            " [n]            | Compare merge sort of list elements with sort "
+            "of an array of pointers, on n strings (default: n == 1000000)");
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
               NULL);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
+    add_param("backend", &backend,
+              "Representation of new queues (0: list, 1: unrolled, 2: ring)",
+              NULL);
+    add_param("sortmode", &sort_mode,
+              "Algorithm used by sort on list queues "
+              "(0: merge, 1: natural, 2: radix, 3: parallel, 4: array)",
+              NULL);
+    add_param("sortthreads", &sort_threads,
+              "Threads used by sort in parallel mode", NULL);
+    add_param("sortmem", &sort_mem,
+              "Scratch memory in KiB xsort may use, within mblimit if set, "
+              "checked once it is done",
+              NULL);
+    add_param("arena", &arena_mode,
+              "Allocate elements of new queues from per-queue slabs", NULL);
+    add_param("intern", &intern_mode,
+              "Share one copy of equal strings in new queues", NULL);
+    add_param("index", &index_mode,
+              "Count the strings of new queues in a hash index", NULL);
 }
 
 static bool do_new(int argc, char *argv[])
@@ -120,8 +292,17 @@ static bool do_new(int argc, char *argv[])
     }
     error_check();
 
-    if (exception_setup(true))
+    if (exception_setup(true)) {
         q = q_new();
+        if (q && !q_set_backend(q, backend))
+            report(3, "Warning: Could not switch to backend %d", backend);
+        if (q && arena_mode && !q_set_arena(q, true))
+            report(3, "Warning: Could not enable arena mode");
+        if (q && intern_mode && !q_set_intern(q, true))
+            report(3, "Warning: Could not enable interning mode");
+        if (q && index_mode && !q_set_index(q, true))
+            report(3, "Warning: Could not enable index mode");
+    }
     exception_cancel();
     qcnt = 0;
     show_queue(3);
@@ -152,6 +333,10 @@ static bool do_free(int argc, char *argv[])
     qcnt = 0;
     show_queue(3);
 
+    /* Blocks of the other queues are still around */
+    if (other_queues_live())
+        return ok && !error_check();
+
     size_t bcnt = allocation_check();
     if (bcnt > 0) {
         report(1, "ERROR: Freed queue, but %lu blocks are still allocated",
@@ -159,6 +344,20 @@ static bool do_free(int argc, char *argv[])
         ok = false;
     }
 
+    /* Every string handed over must have been freed, and only once */
+    size_t wcnt = watched_allocated();
+    if (wcnt > 0) {
+        report(1,
+               "ERROR: Freed queue, but %zu strings handed over are still "
+               "allocated",
+               wcnt);
+        ok = false;
+    } else if (watched_freed() != taken_count) {
+        report(1, "ERROR: %zu strings handed over, but %zu freed",
+               taken_count, watched_freed());
+        ok = false;
+    }
+
     return ok && !error_check();
 }
 /*
@@ -177,10 +376,36 @@ static void fill_rand_string(char *buf, size_t buf_size)
     buf[len] = '\0';
 }
 
+/* Strings inserted per call of q_insert_head_bulk/q_insert_tail_bulk */
+#define BULK_CHUNK 1024
+
+static char *bulk_strs[BULK_CHUNK];
+static char bulk_rand[BULK_CHUNK][MAX_RANDSTR_LEN];
+
+/*
+ * Prepare the strings of the next call of an insert command with a repeat
+ * count: n copies of str, or n random strings if rand is set.
+ */
+static void bulk_fill(char *str, bool rand, int n)
+{
+    for (int i = 0; i < n; i++) {
+        if (rand)
+            fill_rand_string(bulk_rand[i], sizeof(bulk_rand[i]));
+        bulk_strs[i] = rand ? bulk_rand[i] : str;
+    }
+}
+
+/* Return string at head of queue, or NULL if there is none */
+static char *head_value()
+{
+    q_iter_t it;
+    q_iter_init(q, &it);
+    return q_iter_next(&it);
+}
+
 static bool do_insert_head(int argc, char *argv[])
 {
     char *lasts = NULL;
-    char randstr_buf[MAX_RANDSTR_LEN];
     int reps = 1;
     bool ok = true, need_rand = false;
     if (argc != 2 && argc != 3) {
@@ -196,51 +421,78 @@ static bool do_insert_head(int argc, char *argv[])
         }
     }
 
-    if (!strcmp(inserts, "RAND")) {
+    if (!strcmp(inserts, "RAND"))
         need_rand = true;
-        inserts = randstr_buf;
-    }
 
     if (!q)
         report(3, "Warning: Calling insert head on null queue");
     error_check();
 
     if (exception_setup(true)) {
-        for (int r = 0; ok && r < reps; r++) {
-            if (need_rand)
-                fill_rand_string(randstr_buf, sizeof(randstr_buf));
-            bool rval = q_insert_head(q, inserts);
-            if (rval) {
-                qcnt++;
-                if (!q->head->value) {
+        for (int r = 0, n; ok && r < reps; r += n) {
+            n = reps - r < BULK_CHUNK ? reps - r : BULK_CHUNK;
+            bulk_fill(inserts, need_rand, n);
+            if (n > 1 && q_insert_head_bulk(q, bulk_strs, NULL, n)) {
+                q_iter_t it;
+                q_iter_init(q, &it);
+                char *head = q_iter_next(&it);
+                qcnt += n;
+                if (!head) {
                     report(1, "ERROR: Failed to save copy of string in list");
                     ok = false;
-                } else if (r == 0 && inserts == q->head->value) {
+                } else if (head == bulk_strs[n - 1]) {
                     report(1,
                            "ERROR: Need to allocate and copy string for new "
                            "list element");
                     ok = false;
-                    break;
-                } else if (r == 1 && lasts == q->head->value) {
+                } else if (!q->intern && head == q_iter_next(&it)) {
                     report(1,
                            "ERROR: Need to allocate separate string for each "
                            "list element");
                     ok = false;
-                    break;
                 }
-                lasts = q->head->value;
-            } else {
-                fail_count++;
-                if (fail_count < fail_limit)
-                    report(2, "Insertion of %s failed", inserts);
-                else {
-                    report(1,
-                           "ERROR: Insertion of %s failed (%d failures total)",
-                           inserts, fail_count);
-                    ok = false;
+                ok = ok && !error_check();
+                continue;
+            }
+
+            /* Insert one by one, so that failures are counted as such */
+            for (int i = 0; ok && i < n; i++) {
+                bool rval = q_insert_head(q, bulk_strs[i]);
+                if (rval) {
+                    char *head = head_value();
+                    qcnt++;
+                    if (!head) {
+                        report(1,
+                               "ERROR: Failed to save copy of string in list");
+                        ok = false;
+                    } else if (r + i == 0 && bulk_strs[i] == head) {
+                        report(1,
+                               "ERROR: Need to allocate and copy string for "
+                               "new list element");
+                        ok = false;
+                        break;
+                    } else if (r + i == 1 && lasts == head && !q->intern) {
+                        report(1,
+                               "ERROR: Need to allocate separate string for "
+                               "each list element");
+                        ok = false;
+                        break;
+                    }
+                    lasts = head;
+                } else {
+                    fail_count++;
+                    if (fail_count < fail_limit)
+                        report(2, "Insertion of %s failed", bulk_strs[i]);
+                    else {
+                        report(1,
+                               "ERROR: Insertion of %s failed (%d failures "
+                               "total)",
+                               bulk_strs[i], fail_count);
+                        ok = false;
+                    }
                 }
+                ok = ok && !error_check();
             }
-            ok = ok && !error_check();
         }
     }
     exception_cancel();
@@ -265,7 +517,6 @@ static bool do_insert_tail(int argc, char *argv[])
         return ok;
     }
 
-    char randstr_buf[MAX_RANDSTR_LEN];
     int reps = 1;
     bool ok = true, need_rand = false;
     if (argc != 2 && argc != 3) {
@@ -281,34 +532,120 @@ static bool do_insert_tail(int argc, char *argv[])
         }
     }
 
-    if (!strcmp(inserts, "RAND")) {
+    if (!strcmp(inserts, "RAND"))
         need_rand = true;
-        inserts = randstr_buf;
-    }
 
     if (!q)
         report(3, "Warning: Calling insert tail on null queue");
     error_check();
 
+    if (exception_setup(true)) {
+        for (int r = 0, n; ok && r < reps; r += n) {
+            n = reps - r < BULK_CHUNK ? reps - r : BULK_CHUNK;
+            bulk_fill(inserts, need_rand, n);
+            if (n > 1 && q_insert_tail_bulk(q, bulk_strs, NULL, n)) {
+                qcnt += n;
+                if (!head_value()) {
+                    report(1, "ERROR: Failed to save copy of string in list");
+                    ok = false;
+                }
+                ok = ok && !error_check();
+                continue;
+            }
+
+            /* Insert one by one, so that failures are counted as such */
+            for (int i = 0; ok && i < n; i++) {
+                bool rval = q_insert_tail(q, bulk_strs[i]);
+                if (rval) {
+                    qcnt++;
+                    if (!head_value()) {
+                        report(1,
+                               "ERROR: Failed to save copy of string in list");
+                        ok = false;
+                    }
+                } else {
+                    fail_count++;
+                    if (fail_count < fail_limit)
+                        report(2, "Insertion of %s failed", bulk_strs[i]);
+                    else {
+                        report(1,
+                               "ERROR: Insertion of %s failed (%d failures "
+                               "total)",
+                               bulk_strs[i], fail_count);
+                        ok = false;
+                    }
+                }
+                ok = ok && !error_check();
+            }
+        }
+    }
+    exception_cancel();
+    show_queue(3);
+    return ok;
+}
+
+/*
+ * Insert copies of a string, made through the harness so that it can tell
+ * whether the queue frees each of them exactly once, and hand them over
+ * with q_insert_head_take or q_insert_tail_take.
+ */
+static bool do_insert_take(int argc, char *argv[], bool tail)
+{
+    int reps = 1;
+    bool ok = true, need_rand = false;
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+
+    char *inserts = argv[1];
+    if (argc == 3) {
+        if (!get_int(argv[2], &reps)) {
+            report(1, "Invalid number of insertions '%s'", argv[2]);
+            return false;
+        }
+    }
+
+    if (!strcmp(inserts, "RAND"))
+        need_rand = true;
+
+    if (!q)
+        report(3, "Warning: Calling insert on null queue");
+    error_check();
+
+    char randstr_buf[MAX_RANDSTR_LEN];
     if (exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
             if (need_rand)
                 fill_rand_string(randstr_buf, sizeof(randstr_buf));
-            bool rval = q_insert_tail(q, inserts);
+            char *str = need_rand ? randstr_buf : inserts;
+            char *s = test_strdup(str);
+            if (s && !watch_block(s)) {
+                report(1, "ERROR: Harness does not track string to hand over");
+                ok = false;
+                break;
+            }
+            if (s)
+                taken_count++;
+
+            bool rval = s && (tail ? q_insert_tail_take(q, s)
+                                   : q_insert_head_take(q, s));
             if (rval) {
                 qcnt++;
-                if (!q->head->value) {
-                    report(1, "ERROR: Failed to save copy of string in list");
+                /* The string itself, not a copy, must be in the queue */
+                if ((!tail || qcnt == 1) && !q->intern && head_value() != s) {
+                    report(1, "ERROR: Queue copied string handed over to it");
                     ok = false;
                 }
             } else {
+                test_free(s);
                 fail_count++;
                 if (fail_count < fail_limit)
-                    report(2, "Insertion of %s failed", inserts);
+                    report(2, "Insertion of %s failed", str);
                 else {
                     report(1,
                            "ERROR: Insertion of %s failed (%d failures total)",
-                           inserts, fail_count);
+                           str, fail_count);
                     ok = false;
                 }
             }
@@ -320,8 +657,20 @@ static bool do_insert_tail(int argc, char *argv[])
     return ok;
 }
 
-static bool do_remove_head(int argc, char *argv[])
+static bool do_insert_head_take(int argc, char *argv[])
+{
+    return do_insert_take(argc, argv, false);
+}
+
+static bool do_insert_tail_take(int argc, char *argv[])
 {
+    return do_insert_take(argc, argv, true);
+}
+
+/* Remove from head or tail of queue, as rh and rt do */
+static bool do_remove(int argc, char *argv[], bool tail)
+{
+    const char *end = tail ? "tail" : "head";
     if (argc != 1 && argc != 2) {
         report(1, "%s needs 0-1 arguments", argv[0]);
         return false;
@@ -354,14 +703,15 @@ static bool do_remove_head(int argc, char *argv[])
     removes[string_length + STRINGPAD] = '\0';
 
     if (!q)
-        report(3, "Warning: Calling remove head on null queue");
-    else if (!q->head)
-        report(3, "Warning: Calling remove head on empty queue");
+        report(3, "Warning: Calling remove %s on null queue", end);
+    else if (!q_size(q))
+        report(3, "Warning: Calling remove %s on empty queue", end);
     error_check();
 
     bool rval = false;
     if (exception_setup(true))
-        rval = q_remove_head(q, removes, string_length + 1);
+        rval = tail ? q_remove_tail(q, removes, string_length + 1)
+                    : q_remove_head(q, removes, string_length + 1);
     exception_cancel();
 
     if (rval) {
@@ -380,8 +730,9 @@ static bool do_remove_head(int argc, char *argv[])
             i++;
         if (i != string_length + STRINGPAD) {
             report(1,
-                   "ERROR: copying of string in remove_head overflowed "
-                   "destination buffer.");
+                   "ERROR: copying of string in remove_%s overflowed "
+                   "destination buffer.",
+                   end);
             ok = false;
         } else {
             report(2, "Removed %s from queue", removes);
@@ -411,6 +762,77 @@ static bool do_remove_head(int argc, char *argv[])
     return ok && !error_check();
 }
 
+static bool do_remove_head(int argc, char *argv[])
+{
+    return do_remove(argc, argv, false);
+}
+
+static bool do_remove_tail(int argc, char *argv[])
+{
+    if (simulation) {
+        if (argc != 1) {
+            report(1, "%s does not need arguments in simulation mode", argv[0]);
+            return false;
+        }
+        /* Checking each free against every block would take linear time */
+        set_cautious_mode(false);
+        bool ok = is_remove_tail_const();
+        set_cautious_mode(true);
+        if (!ok) {
+            report(1, "ERROR: Probably not constant time");
+            return false;
+        }
+        report(1, "Probably constant time");
+        return ok;
+    }
+
+    return do_remove(argc, argv, true);
+}
+
+static bool do_peek(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling peek on null queue");
+    error_check();
+
+    char *head = NULL, *tail = NULL;
+    if (exception_setup(true)) {
+        head = q_peek_head(q);
+        tail = q_peek_tail(q);
+    }
+    exception_cancel();
+
+    bool ok = true;
+    if (!qcnt) {
+        if (head || tail) {
+            report(1, "ERROR: Peeked at a string in an empty queue");
+            ok = false;
+        } else {
+            report(2, "Queue is empty");
+        }
+        return ok && !error_check();
+    }
+
+    /* Compare with what walking through the queue finds */
+    q_iter_t it;
+    q_iter_init(q, &it);
+    char *first = q_iter_next(&it), *last = first, *s;
+    while ((s = q_iter_next(&it)))
+        last = s;
+    if (head != first || tail != last) {
+        report(1, "ERROR: Peeked strings are not at head and tail of queue");
+        ok = false;
+    } else {
+        report(2, "Head = %s, tail = %s", head, tail);
+    }
+    return ok && !error_check();
+}
+
 static bool do_remove_head_quiet(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -421,7 +843,7 @@ static bool do_remove_head_quiet(int argc, char *argv[])
     bool ok = true;
     if (!q)
         report(3, "Warning: Calling remove head on null queue");
-    else if (!q->head)
+    else if (!q_size(q))
         report(3, "Warning: Calling remove head on empty queue");
     error_check();
 
@@ -447,8 +869,125 @@ static bool do_remove_head_quiet(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/*
+ * Parse the optional element count of rhb and drain into *cnt, which
+ * defaults to the whole queue.
+ */
+static bool get_bulk_count(int argc, char *argv[], int *cnt)
+{
+    if (argc > 2) {
+        report(1, "%s takes at most 1 argument", argv[0]);
+        return false;
+    }
+    *cnt = qcnt;
+    if (argc == 2 && (!get_int(argv[1], cnt) || *cnt < 0)) {
+        report(1, "Invalid number of elements '%s'", argv[1]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling remove head on null queue");
+    else if (!q_size(q))
+        report(3, "Warning: Calling remove head on empty queue");
+    error_check();
+    return true;
+}
+
+static bool do_remove_head_bulk(int argc, char *argv[])
+{
+    int cnt;
+    if (!get_bulk_count(argc, argv, &cnt))
+        return false;
+
+    int want = cnt < (int) qcnt ? cnt : (int) qcnt, removed = 0;
+    bool ok = true;
+    if (exception_setup(true)) {
+        while (ok && removed < want) {
+            int n = want - removed < BULK_CHUNK ? want - removed : BULK_CHUNK;
+            int got = q_remove_head_bulk(q, bulk_strs, n);
+            for (int i = 0; ok && i < got; i++) {
+                if (!bulk_strs[i]) {
+                    report(1, "ERROR: Removed a NULL string");
+                    ok = false;
+                }
+            }
+            if (ok && q_free_strings(q, bulk_strs, got) != got) {
+                report(1, "ERROR: Could not free strings removed");
+                ok = false;
+            }
+            removed += got;
+            qcnt -= got;
+            if (got < n)
+                break;
+        }
+    }
+    exception_cancel();
+
+    if (ok && removed != want) {
+        report(1, "ERROR: Removed %d elements, but expected %d", removed,
+               want);
+        ok = false;
+    }
+    report(2, "Removed %d elements from queue", removed);
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_drain(int argc, char *argv[])
+{
+    int cnt;
+    if (!get_bulk_count(argc, argv, &cnt))
+        return false;
+    if (q && q->backend != Q_BACKEND_LIST) {
+        report(1, "%s only works on list queues", argv[0]);
+        return false;
+    }
+
+    int want = cnt < (int) qcnt ? cnt : (int) qcnt, n = 0, walked = 0;
+    bool ok = true;
+    if (exception_setup(true)) {
+        list_ele_t *chain = q_drain(q, cnt, &n);
+        for (list_ele_t *e = chain; ok && e; e = e->next) {
+            if (!e->value) {
+                report(1, "ERROR: Detached element holds NULL string");
+                ok = false;
+            }
+            walked++;
+        }
+        qcnt -= n;
+        if (ok)
+            q_release(q, chain);
+    }
+    exception_cancel();
+
+    if (ok && (n != want || walked != n)) {
+        report(1,
+               "ERROR: Detached chain of %d elements, reported as %d, but "
+               "expected %d",
+               walked, n, want);
+        ok = false;
+    }
+    report(2, "Detached %d elements from queue", n);
+    show_queue(3);
+    return ok && !error_check();
+}
+
 static bool do_reverse(int argc, char *argv[])
 {
+    if (simulation) {
+        if (argc != 1) {
+            report(1, "%s does not need arguments in simulation mode", argv[0]);
+            return false;
+        }
+        bool ok = is_reverse_const();
+        if (!ok) {
+            report(1, "ERROR: Probably not constant time");
+            return false;
+        }
+        report(1, "Probably constant time");
+        return ok;
+    }
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -547,6 +1086,16 @@ bool do_sort(int argc, char *argv[])
         report(3, "Warning: Calling sort on single node");
     error_check();
 
+    if (q && !q_set_sort_mode(q, sort_mode)) {
+        report(1, "ERROR: Unknown sort mode %d", sort_mode);
+        return false;
+    }
+    if (q && !q_set_sort_threads(q, sort_threads)) {
+        report(1, "ERROR: Sort threads must be between 1 and %d",
+               Q_SORT_MAX_THREADS);
+        return false;
+    }
+
     set_noallocate_mode(true);
     if (exception_setup(true))
         q_sort(q);
@@ -555,15 +1104,22 @@ bool do_sort(int argc, char *argv[])
 
     bool ok = true;
     if (q) {
-        for (list_ele_t *e = q->head; e && --cnt; e = e->next) {
+        q_iter_t it;
+        q_iter_init(q, &it);
+        char *prev = q_iter_next(&it), *cur;
+        for (; prev && --cnt && (cur = q_iter_next(&it)); prev = cur) {
             /* Ensure each element in ascending order */
             /* FIXME: add an option to specify sorting order */
-            if (strcasecmp(e->value, e->next->value) > 0) {
+            if (strcasecmp(prev, cur) > 0) {
                 report(1, "ERROR: Not sorted in ascending order");
                 ok = false;
                 break;
             }
         }
+        if (q->sort_compares)
+            report(2, "Sorted with %zu comparisons, %zu (%.1f%%) past prefix",
+                   q->sort_compares, q->sort_fallbacks,
+                   100.0 * q->sort_fallbacks / q->sort_compares);
     }
 
     show_queue(3);
@@ -583,12 +1139,15 @@ static bool show_queue(int vlevel)
     }
 
     report_noreturn(vlevel, "q = [");
-    list_ele_t *e = q->head;
+    q_iter_t it;
+    char *e = NULL;
     if (exception_setup(true)) {
+        q_iter_init(q, &it);
+        e = q_iter_next(&it);
         while (ok && e && cnt < qcnt) {
             if (cnt < big_queue_size)
-                report_noreturn(vlevel, cnt == 0 ? "%s" : " %s", e->value);
-            e = e->next;
+                report_noreturn(vlevel, cnt == 0 ? "%s" : " %s", e);
+            e = q_iter_next(&it);
             cnt++;
             ok = ok && !error_check();
         }
@@ -617,28 +1176,867 @@ static bool show_queue(int vlevel)
     return ok;
 }
 
-static bool do_show(int argc, char *argv[])
+/*
+ * Return a new array of the strings in the queue, in queue order, and
+ * store their number in *n.
+ * Return NULL if could not allocate space.
+ */
+static char **queue_strings(int *n)
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
-        return false;
-    }
-    return show_queue(0);
+    *n = q_size(q);
+    char **v = malloc((*n + 1) * sizeof(char *));
+    if (!v)
+        return NULL;
+
+    q_iter_t it;
+    q_iter_init(q, &it);
+    for (int i = 0; i < *n; i++)
+        v[i] = q_iter_next(&it);
+    return v;
 }
 
-/* Signal handlers */
-static void sigsegvhandler(int sig)
+static int str_cmp(const void *a, const void *b)
 {
-    report(1,
-           "Segmentation fault occurred.  You dereferenced a NULL or invalid "
-           "pointer");
-    /* Raising a SIGABRT signal to produce a core dump for debugging. */
-    abort();
+    return strcmp(*(char *const *) a, *(char *const *) b);
 }
 
-static void sigalrmhandler(int sig)
+/*
+ * Get k, the argument of topk and nth, and the strings of the queue in
+ * ascending order, as a full sort would leave them, into *sorted.
+ */
+static bool get_order_args(int argc,
+                           char *argv[],
+                           int *k,
+                           char ***sorted,
+                           int *n)
 {
-    trigger_exception(
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+    if (!get_int(argv[1], k) || *k < 0) {
+        report(1, "Invalid index '%s'", argv[1]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling %s on null queue", argv[0]);
+    error_check();
+
+    *sorted = queue_strings(n);
+    if (!*sorted) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for strings");
+        return false;
+    }
+    qsort(*sorted, *n, sizeof(char *), str_cmp);
+    return true;
+}
+
+static bool do_topk(int argc, char *argv[])
+{
+    int k, n;
+    char **sorted;
+    if (!get_order_args(argc, argv, &k, &sorted, &n))
+        return false;
+
+    set_noallocate_mode(true);
+    if (exception_setup(true))
+        q_partial_sort(q, k);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    bool ok = true;
+    int m;
+    char **now = queue_strings(&m);
+    if (!now) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for strings");
+        ok = false;
+    } else if (m != n) {
+        report(1, "ERROR: Queue has %d elements, but had %d", m, n);
+        ok = false;
+    }
+    for (int i = 0; ok && i < k && i < n; i++) {
+        if (strcmp(now[i], sorted[i])) {
+            report(1, "ERROR: Element %d is %s, but expected %s", i, now[i],
+                   sorted[i]);
+            ok = false;
+        }
+    }
+    if (ok) {
+        /* The rest must be the same strings, in any order */
+        qsort(now, n, sizeof(char *), str_cmp);
+        for (int i = 0; ok && i < n; i++) {
+            if (strcmp(now[i], sorted[i])) {
+                report(1, "ERROR: Elements of queue changed");
+                ok = false;
+            }
+        }
+    }
+    if (ok && q && k > 0 && q->sort_compares)
+        report(2, "Sorted %d smallest with %zu comparisons", k < n ? k : n,
+               q->sort_compares);
+    free(now);
+    free(sorted);
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_nth(int argc, char *argv[])
+{
+    int k, n;
+    char **sorted;
+    if (!get_order_args(argc, argv, &k, &sorted, &n))
+        return false;
+
+    int m;
+    char **before = queue_strings(&m);
+    if (!before) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for strings");
+        free(sorted);
+        return false;
+    }
+
+    char *s = NULL;
+    set_noallocate_mode(true);
+    if (exception_setup(true))
+        s = q_select(q, k);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    bool ok = true;
+    if (k >= n) {
+        if (s) {
+            report(1, "ERROR: Found element %s past the tail", s);
+            ok = false;
+        } else {
+            report(3, "Warning: Index %d is past the tail", k);
+        }
+    } else if (!s) {
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "Selection of element %d failed", k);
+        } else {
+            report(1, "ERROR: Selection of element %d failed (%d failures "
+                      "total)",
+                   k, fail_count);
+            ok = false;
+        }
+    } else if (strcmp(s, sorted[k])) {
+        report(1, "ERROR: Element %d in order is %s, but expected %s", k, s,
+               sorted[k]);
+        ok = false;
+    } else {
+        report(2, "Element %d in order is %s", k, s);
+    }
+
+    /* Selection must leave the queue as it was */
+    char **after = queue_strings(&m);
+    for (int i = 0; ok && after && i < n; i++) {
+        if (after[i] != before[i]) {
+            report(1, "ERROR: Selection reordered queue");
+            ok = false;
+        }
+    }
+    free(after);
+    free(before);
+    free(sorted);
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_use(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    int i = find_queue(argv[1], true);
+    if (i < 0) {
+        report(1, "Could not add queue '%s': names must be shorter than %d "
+                  "characters, and at most %d queues exist",
+               argv[1], QUEUE_NAME_LEN, MAX_QUEUES);
+        return false;
+    }
+
+    queues[cur_queue].q = q;
+    queues[cur_queue].qcnt = qcnt;
+    cur_queue = i;
+    q = queues[i].q;
+    qcnt = queues[i].qcnt;
+    show_queue(3);
+    return true;
+}
+
+static bool do_merge(int argc, char *argv[])
+{
+    if (argc < 2) {
+        report(1, "%s needs at least 1 argument", argv[0]);
+        return false;
+    }
+
+    /* The current queue goes first, so it takes in the others */
+    int k = argc, idx[MAX_QUEUES];
+    queue_t *qs[MAX_QUEUES];
+    if (k > MAX_QUEUES) {
+        report(1, "Cannot merge more than %d queues", MAX_QUEUES);
+        return false;
+    }
+    idx[0] = cur_queue;
+    qs[0] = q;
+    for (int i = 1; i < k; i++) {
+        idx[i] = find_queue(argv[i], false);
+        for (int j = 0; idx[i] >= 0 && j < i; j++)
+            if (idx[j] == idx[i])
+                idx[i] = -1;
+        if (idx[i] < 0) {
+            report(1, "No queue '%s' to merge, or named more than once",
+                   argv[i]);
+            return false;
+        }
+        qs[i] = queues[idx[i]].q;
+    }
+
+    /* All strings, sorted, are what the merged queue must hold */
+    size_t total = 0;
+    for (int i = 0; i < k; i++)
+        total += q_size(qs[i]);
+    char **sorted = malloc((total + 1) * sizeof(char *));
+    if (!sorted) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for strings");
+        return false;
+    }
+    size_t n = 0;
+    for (int i = 0; i < k; i++) {
+        q_iter_t it;
+        char *s;
+        q_iter_init(qs[i], &it);
+        while ((s = q_iter_next(&it)))
+            sorted[n++] = s;
+    }
+    qsort(sorted, n, sizeof(char *), str_cmp);
+
+    int size = -1;
+    set_noallocate_mode(true);
+    if (exception_setup(true))
+        size = q_merge(qs, k);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    bool ok = true;
+    if (size < 0) {
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "Merge failed");
+        } else {
+            report(1, "ERROR: Merge failed (%d failures total)", fail_count);
+            ok = false;
+        }
+    } else {
+        for (int i = 1; i < k; i++)
+            qcnt += queues[idx[i]].qcnt;
+        for (int i = 1; i < k; i++)
+            queues[idx[i]].qcnt = 0;
+        if ((size_t) size != n || (size_t) q_size(q) != n) {
+            report(1, "ERROR: Merged %zu elements, but queue has %d", n,
+                   q_size(q));
+            ok = false;
+        }
+
+        q_iter_t it;
+        char *s;
+        size_t i = 0;
+        q_iter_init(q, &it);
+        while (ok && (s = q_iter_next(&it)) && i < n) {
+            if (strcmp(s, sorted[i++])) {
+                report(1, "ERROR: Merged queue not in ascending order");
+                ok = false;
+            }
+        }
+        for (int j = 1; ok && j < k; j++) {
+            if (q_size(qs[j])) {
+                report(1, "ERROR: Queue '%s' not emptied by merge",
+                       queues[idx[j]].name);
+                ok = false;
+            }
+        }
+        report(2, "Merged %d queues into %d elements", k, size);
+    }
+    free(sorted);
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+/*
+ * Look up string argv[1] argv[2] times, by q_count if count is set, else
+ * by q_contains, and check the answers against a walk of the queue.
+ */
+static bool lookup(int argc, char *argv[], bool count)
+{
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+
+    int reps = 1;
+    if (argc == 3 && (!get_int(argv[2], &reps) || reps < 1)) {
+        report(1, "Invalid number of lookups '%s'", argv[2]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling %s on null queue", argv[0]);
+    error_check();
+
+    q_iter_t it;
+    char *s;
+    int expect = 0;
+    q_iter_init(q, &it);
+    while ((s = q_iter_next(&it)))
+        expect += !strcmp(s, argv[1]);
+    if (!count)
+        expect = expect > 0;
+
+    bool ok = true;
+    int got = -1;
+    set_noallocate_mode(true);
+    if (exception_setup(true)) {
+        for (int r = 0; ok && r < reps; r++) {
+            got = count ? q_count(q, argv[1]) : q_contains(q, argv[1]);
+            ok = got == expect;
+        }
+    }
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    if (!ok) {
+        report(1, "ERROR: Found %d of '%s', but queue holds %d", got, argv[1],
+               expect);
+    } else if (count) {
+        report(2, "Queue holds %d of '%s'", got, argv[1]);
+    } else {
+        report(2, "Queue %s '%s'", got ? "contains" : "does not contain",
+               argv[1]);
+    }
+    return ok && !error_check();
+}
+
+static bool do_find(int argc, char *argv[])
+{
+    return lookup(argc, argv, false);
+}
+
+static bool do_count(int argc, char *argv[])
+{
+    return lookup(argc, argv, true);
+}
+
+/* Order pointers into an array of strings by string, then by position */
+static int slot_cmp(const void *a, const void *b)
+{
+    char *const *x = *(char *const *const *) a;
+    char *const *y = *(char *const *const *) b;
+    int c = strcmp(*x, *y);
+    return c ? c : (x > y) - (x < y);
+}
+
+static bool do_dedup(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling dedup on null queue");
+    error_check();
+
+    /* The first element holding each string is to stay, in place */
+    int n;
+    char **v = queue_strings(&n);
+    char ***slot = v ? malloc((n + 1) * sizeof(char **)) : NULL;
+    if (!slot) {
+        free(v);
+        report(1, "INTERNAL ERROR.  Could not allocate space for strings");
+        return false;
+    }
+    for (int i = 0; i < n; i++)
+        slot[i] = &v[i];
+    qsort(slot, n, sizeof(char **), slot_cmp);
+    int keep = n;
+    for (int i = 1, first = 0; i < n; i++) {
+        if (strcmp(*slot[i], *slot[first])) {
+            first = i;
+        } else {
+            *slot[i] = NULL;
+            keep--;
+        }
+    }
+    free(slot);
+
+    int removed = -1;
+    if (qcnt > big_queue_size)
+        set_cautious_mode(false);
+    if (exception_setup(true))
+        removed = q_dedup(q);
+    exception_cancel();
+    set_cautious_mode(true);
+
+    bool ok = true;
+    if (removed >= 0) {
+        qcnt -= removed;
+        if (removed != n - keep || q_size(q) != keep) {
+            report(1, "ERROR: Removed %d elements, but %d were duplicates",
+                   removed, n - keep);
+            ok = false;
+        }
+
+        q_iter_t it;
+        char *s;
+        int i = 0;
+        q_iter_init(q, &it);
+        while (ok && (s = q_iter_next(&it))) {
+            while (!v[i])
+                i++;
+            if (s != v[i++]) {
+                report(1, "ERROR: Did not keep first of each string");
+                ok = false;
+            }
+        }
+        report(2, "Removed %d duplicates", removed);
+    } else if (q) {
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "Dedup failed");
+        } else {
+            report(1, "ERROR: Dedup failed (%d failures total)", fail_count);
+            ok = false;
+        }
+    }
+    free(v);
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_show(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+    return show_queue(0);
+}
+
+static bool do_save(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling save on null queue");
+    error_check();
+
+    int fd = open(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        report(1, "Could not open file '%s'", argv[1]);
+        return false;
+    }
+
+    bool ok = false;
+    set_noallocate_mode(true);
+    if (exception_setup(true))
+        ok = q_dump(q, fd);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    if (close(fd))
+        ok = false;
+    if (!ok && q) {
+        report(1, "ERROR: Could not save queue to '%s'", argv[1]);
+        return false;
+    }
+    report(2, "Saved %d elements to '%s'", q_size(q), argv[1]);
+    return !error_check();
+}
+
+static bool do_load(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling load on null queue");
+    error_check();
+
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        report(1, "Could not open file '%s'", argv[1]);
+        return false;
+    }
+
+    int n = -1;
+    if (exception_setup(true))
+        n = q_load(q, fd);
+    exception_cancel();
+    close(fd);
+
+    bool ok = true;
+    if (n >= 0) {
+        qcnt += n;
+        report(2, "Loaded %d elements from '%s'", n, argv[1]);
+    } else if (q) {
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "Loading of '%s' failed", argv[1]);
+        } else {
+            report(1, "ERROR: Loading of '%s' failed (%d failures total)",
+                   argv[1], fail_count);
+            ok = false;
+        }
+    }
+    show_queue(3);
+    return ok && !error_check();
+}
+
+/* Return resident set size of this process in KiB, or 0 if unknown */
+static long resident_kib()
+{
+    FILE *f = fopen("/proc/self/status", "r");
+    if (!f)
+        return 0;
+
+    char line[128];
+    long kib = 0;
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "VmRSS: %ld kB", &kib) == 1)
+            break;
+    fclose(f);
+    return kib;
+}
+
+static bool do_mapload(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        report(1, "Could not open file '%s'", argv[1]);
+        return false;
+    }
+
+    bool ok = true;
+    if (q) {
+        report(3, "Freeing old queue");
+        ok = do_free(1, argv);
+    }
+    error_check();
+
+    size_t heap = allocation_bytes();
+    long rss = resident_kib();
+    int n = -1;
+    if (exception_setup(true)) {
+        q = q_new();
+        n = q_map(q, fd);
+    }
+    exception_cancel();
+    qcnt = 0;
+
+    if (n < 0) {
+        close(fd);
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "Mapping of '%s' failed", argv[1]);
+        } else {
+            report(1, "ERROR: Mapping of '%s' failed (%d failures total)",
+                   argv[1], fail_count);
+            ok = false;
+        }
+        show_queue(3);
+        return ok && !error_check();
+    }
+    qcnt = n;
+    report(2, "Mapped %d elements: %zu KiB on heap, %ld KiB more resident", n,
+           (allocation_bytes() - heap) / 1024, resident_kib() - rss);
+
+    /* Load a copy the usual way, to see what mapping saved.  Only the
+     * mapping is under test, so this is not held to the time limit.
+     */
+    heap = allocation_bytes();
+    rss = resident_kib();
+    set_cautious_mode(false);
+    if (exception_setup(false)) {
+        queue_t *copy = q_new();
+        if (copy && lseek(fd, 0, SEEK_SET) == 0 && q_load(copy, fd) == n)
+            report(2, "Loaded copy: %zu KiB on heap, %ld KiB more resident",
+                   (allocation_bytes() - heap) / 1024, resident_kib() - rss);
+        else
+            report(2, "Could not load copy of '%s' to compare", argv[1]);
+        q_free(copy);
+    }
+    exception_cancel();
+    set_cautious_mode(true);
+    close(fd);
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+/* 64-bit FNV-1a hash of string s */
+static uint64_t str_hash(const char *s)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *s; s++) {
+        h ^= (unsigned char) *s;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/*
+ * Check that queue r still holds n strings whose hashes add up to sum, in
+ * whatever order.
+ */
+static bool check_kept(queue_t *r, int n, uint64_t sum)
+{
+    q_iter_t it;
+    char *s;
+    int cnt = 0;
+    q_iter_init(r, &it);
+    for (; (s = q_iter_next(&it)); cnt++)
+        sum -= str_hash(s);
+    if (cnt != n || sum) {
+        report(1, "ERROR: Sort failed, and lost strings of the queue");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Check that queue r holds n strings in ascending order, whose hashes add
+ * up to sum, as those of the queue sorted did.
+ */
+static bool check_sorted(queue_t *r, int n, uint64_t sum)
+{
+    q_iter_t it;
+    char *s, *prev = NULL;
+    int cnt = 0;
+    q_iter_init(r, &it);
+    for (; (s = q_iter_next(&it)); prev = s, cnt++) {
+        if (prev && strcmp(prev, s) > 0) {
+            report(1, "ERROR: Not sorted in ascending order");
+            return false;
+        }
+        sum -= str_hash(s);
+    }
+    if (cnt != n || sum) {
+        report(1, "ERROR: Sorted %d elements, but not the ones queued", cnt);
+        return false;
+    }
+    return true;
+}
+
+static bool do_xsort(int argc, char *argv[])
+{
+    if (argc > 2) {
+        report(1, "%s takes at most 1 argument", argv[0]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling xsort on null queue");
+    error_check();
+
+    int fd = -1;
+    if (argc == 2 &&
+        (fd = open(argv[1], O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+        report(1, "Could not open file '%s'", argv[1]);
+        return false;
+    }
+
+    /* Leave room within mblimit for what qtest holds already */
+    size_t budget = (size_t) sort_mem << 10;
+    if (budget > mem_available())
+        budget = mem_available();
+
+    /* Strings may come back from a file, so compare them by hash */
+    uint64_t sum = 0;
+    q_iter_t it;
+    char *s;
+    q_iter_init(q, &it);
+    while ((s = q_iter_next(&it)))
+        sum += str_hash(s);
+
+    int cnt = q_size(q), n = -1;
+    size_t heap = allocation_bytes();
+    allocation_peak();
+    /* Elements going to a file are freed, as by the free command */
+    if (qcnt > big_queue_size)
+        set_cautious_mode(false);
+    if (exception_setup(true))
+        n = q_sort_external(q, budget, fd);
+    exception_cancel();
+    set_cautious_mode(true);
+    /* Scratch memory counts against mblimit, as does that of qtest.  It is
+     * only measured once the sort is over, so an overrun is caught then
+     * rather than prevented.
+     */
+    size_t extra = allocation_peak() - heap;
+    mem_charge(extra);
+    mem_release(extra);
+
+    bool ok = true;
+    if (n < 0) {
+        /* Strings spilled on the way to a file are lost */
+        qcnt = q_size(q);
+        if (q && fd < 0 && !check_kept(q, cnt, sum))
+            ok = false;
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "External sort failed");
+        } else {
+            report(1, "ERROR: External sort failed (%d failures total)",
+                   fail_count);
+            ok = false;
+        }
+    } else if (extra > budget) {
+        report(1, "ERROR: External sort took %zu bytes over the limit of %zu",
+               extra, budget);
+        ok = false;
+    } else if (fd < 0) {
+        report(2, "Sorted %d elements in %zu KiB of scratch memory", n,
+               extra / 1024);
+        ok = check_sorted(q, cnt, sum);
+    } else {
+        /* Read the snapshot back in place to check it */
+        qcnt = 0;
+        report(2, "Sorted %d elements into '%s' in %zu KiB of scratch memory",
+               n, argv[1], extra / 1024);
+        queue_t *r = q_new();
+        if (!r || q_map(r, fd) != n) {
+            report(1, "ERROR: Could not read back sorted '%s'", argv[1]);
+            ok = false;
+        } else {
+            ok = check_sorted(r, cnt, sum);
+        }
+        q_free(r);
+    }
+    if (fd >= 0 && close(fd))
+        ok = false;
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_mpmc(int argc, char *argv[])
+{
+    if (argc != 3 && argc != 4) {
+        report(1, "%s needs 2-3 arguments", argv[0]);
+        return false;
+    }
+
+    int producers, consumers, count = 100000;
+    if (!get_int(argv[1], &producers) || !get_int(argv[2], &consumers) ||
+        (argc == 4 && !get_int(argv[3], &count))) {
+        report(1, "Invalid number of threads or strings");
+        return false;
+    }
+    if (producers < 1 || consumers < 1 ||
+        producers + consumers > MSQ_MAX_THREADS || count < 0) {
+        report(1, "Need at least one producer and consumer, and at most %d "
+                  "threads in all",
+               MSQ_MAX_THREADS);
+        return false;
+    }
+
+    return bench_mpmc(producers, consumers, count);
+}
+
+static bool do_spsc(int argc, char *argv[])
+{
+    if (argc > 3) {
+        report(1, "%s takes at most 2 arguments", argv[0]);
+        return false;
+    }
+
+    int count = 1000000, batch = 1;
+    if ((argc > 1 && !get_int(argv[1], &count)) ||
+        (argc > 2 && !get_int(argv[2], &batch))) {
+        report(1, "Invalid number of strings or batch size");
+        return false;
+    }
+    if (count < 0 || batch < 1 || batch > 1024) {
+        report(1, "Batch size must be between 1 and 1024");
+        return false;
+    }
+
+    return bench_spsc(count, batch);
+}
+
+static bool do_intern(int argc, char *argv[])
+{
+    if (argc > 3) {
+        report(1, "%s takes at most 2 arguments", argv[0]);
+        return false;
+    }
+
+    int count = 100000, distinct = 100;
+    if ((argc > 1 && !get_int(argv[1], &count)) ||
+        (argc > 2 && !get_int(argv[2], &distinct))) {
+        report(1, "Invalid number of strings or values");
+        return false;
+    }
+    if (count < 1 || distinct < 1) {
+        report(1, "Need at least one string and one value");
+        return false;
+    }
+
+    return bench_intern(count, distinct);
+}
+
+static bool do_sortbench(int argc, char *argv[])
+{
+    if (argc > 2) {
+        report(1, "%s takes at most 1 argument", argv[0]);
+        return false;
+    }
+
+    int count = 1000000;
+    if (argc > 1 && !get_int(argv[1], &count)) {
+        report(1, "Invalid number of strings");
+        return false;
+    }
+    if (count < 1) {
+        report(1, "Need at least one string");
+        return false;
+    }
+
+    return bench_sort(count);
+}
+
+/* Signal handlers */
+static void sigsegvhandler(int sig)
+{
+    report(1,
+           "Segmentation fault occurred.  You dereferenced a NULL or invalid "
+           "pointer");
+    /* Raising a SIGABRT signal to produce a core dump for debugging. */
+    abort();
+}
+
+static void sigalrmhandler(int sig)
+{
+    trigger_exception(
         "Time limit exceeded.  Either you are in an infinite loop, or your "
         "code is too inefficient");
 }
@@ -654,13 +2052,18 @@ static void queue_init()
 static bool queue_quit(int argc, char *argv[])
 {
     report(3, "Freeing queue");
-    if (qcnt > big_queue_size)
-        set_cautious_mode(false);
-
-    if (exception_setup(true))
-        q_free(q);
-    exception_cancel();
-    set_cautious_mode(true);
+    queues[cur_queue].q = q;
+    queues[cur_queue].qcnt = qcnt;
+    for (int i = 0; i < nqueues; i++) {
+        if (queues[i].qcnt > big_queue_size)
+            set_cautious_mode(false);
+        if (exception_setup(true))
+            q_free(queues[i].q);
+        exception_cancel();
+        set_cautious_mode(true);
+        queues[i].q = NULL;
+    }
+    q = NULL;
 
     size_t bcnt = allocation_check();
     if (bcnt > 0) {
@@ -1,9 +1,19 @@
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "harness.h"
 #include "queue.h"
+#include "ring.h"
+#include "unrolled.h"
 
 /*
  * Create empty queue.
@@ -19,9 +29,74 @@ queue_t *q_new()
     q->head = NULL;
     q->tail = NULL;
     q->size = 0;
+    q->reversed = false;
+    q->adopted = 0;
+    q->lent = NULL;
+    q->lent_tail = NULL;
+    q->arena = NULL;
+    q->intern = NULL;
+    q->index = NULL;
+    q->backend = Q_BACKEND_LIST;
+    q->unrolled = NULL;
+    q->ring = NULL;
+    q->map = NULL;
+    q->map_size = 0;
+    q->sort_mode = Q_SORT_MERGE;
+    q->sort_threads = Q_SORT_DEFAULT_THREADS;
+    q->sort_compares = 0;
+    q->sort_fallbacks = 0;
+    if (Q_DEFAULT_BACKEND != Q_BACKEND_LIST &&
+        !q_set_backend(q, Q_DEFAULT_BACKEND)) {
+        free(q);
+        return NULL;
+    }
     return q;
 }
 
+/*
+ * Helpers for the backends that hold strings allocated apart from their
+ * own bookkeeping, i.e. all but Q_BACKEND_LIST.
+ */
+
+/*
+ * Store string p at head or tail.
+ * Return false if could not allocate space, or q is a read-only view.
+ */
+static bool backend_push(queue_t *q, char *p, bool tail)
+{
+    if (q->backend == Q_BACKEND_MAPPED)
+        return false;
+    if (q->backend == Q_BACKEND_UNROLLED)
+        return tail ? unrolled_push_tail(q->unrolled, p)
+                    : unrolled_push_head(q->unrolled, p);
+    return tail ? ring_push_tail(q->ring, p) : ring_push_head(q->ring, p);
+}
+
+/* Detach string at head or tail. Return NULL if empty */
+static char *backend_pop(queue_t *q, bool tail)
+{
+    if (q->backend == Q_BACKEND_UNROLLED)
+        return tail ? unrolled_pop_tail(q->unrolled)
+                    : unrolled_pop_head(q->unrolled);
+    return tail ? ring_pop_tail(q->ring) : ring_pop_head(q->ring);
+}
+
+/* Free string s once out of q.  Strings of a mapped queue stay in the file */
+static void backend_str_free(queue_t *q, char *s)
+{
+    if (q->backend != Q_BACKEND_MAPPED)
+        free(s);
+}
+
+/* Drop the file mapping of a Q_BACKEND_MAPPED queue, if any */
+static void map_release(queue_t *q)
+{
+    if (q->map)
+        munmap(q->map, q->map_size);
+    q->map = NULL;
+    q->map_size = 0;
+}
+
 /* Free all storage used by queue */
 void q_free(queue_t *q)
 {
@@ -29,16 +104,383 @@ void q_free(queue_t *q)
     if (!q)
         return;
 
+    if (q->backend != Q_BACKEND_LIST) {
+        q_iter_t it;
+        char *s;
+        q_iter_init(q, &it);
+        while (q->backend != Q_BACKEND_MAPPED && (s = q_iter_next(&it)))
+            free(s); /* Strings of a mapped queue go with the mapping */
+        unrolled_free(q->unrolled);
+        ring_free(q->ring);
+        map_release(q);
+    }
+
+    /* Elements whose strings were never handed back go along with the rest */
+    if (q->lent) {
+        q->lent_tail->next = q->head;
+        q->head = q->lent;
+    }
+
+    if (q->arena) {
+        /* Strings taken over live apart from the slabs */
+        for (list_ele_t *e = q->head; q->adopted && e; e = e->next)
+            if (e->value != e->data) {
+                free(e->value);
+                q->adopted--;
+            }
+        /* Elements live in the slabs, so drop them all at once */
+        arena_free(q->arena);
+        q->head = NULL;
+    }
+
     while (q->head) {
         list_ele_t *tmp = q->head;
         q->head = q->head->next;
-        free(tmp->value);
+        /* Shared strings go along with their table below */
+        if (tmp->value != tmp->data && !q->intern)
+            free(tmp->value);
         free(tmp);
     }
+    intern_free(q->intern);
+    strset_free(q->index);
     /* Free queue structure */
     free(q);
 }
 
+bool q_set_backend(queue_t *q, q_backend_t backend)
+{
+    if (!q || q->size || q->lent || backend > Q_BACKEND_RING)
+        return false;
+    if (backend == q->backend)
+        return true;
+    if (backend != Q_BACKEND_LIST && (q->arena || q->intern || q->index))
+        return false;
+
+    unrolled_t *u = NULL;
+    ring_t *r = NULL;
+    if (backend == Q_BACKEND_UNROLLED && !(u = unrolled_new()))
+        return false;
+    if (backend == Q_BACKEND_RING && !(r = ring_new()))
+        return false;
+
+    unrolled_free(q->unrolled);
+    ring_free(q->ring);
+    map_release(q);
+    q->unrolled = u;
+    q->ring = r;
+    q->backend = backend;
+    return true;
+}
+
+bool q_set_arena(queue_t *q, bool on)
+{
+    if (!q || q->head || q->lent || q->backend != Q_BACKEND_LIST)
+        return false;
+
+    if (!on) {
+        arena_free(q->arena);
+        q->arena = NULL;
+    } else if (!q->arena) {
+        q->arena = arena_new();
+    }
+    return !on || q->arena != NULL;
+}
+
+bool q_set_intern(queue_t *q, bool on)
+{
+    if (!q || q->head || q->lent || q->backend != Q_BACKEND_LIST)
+        return false;
+
+    if (!on) {
+        intern_free(q->intern);
+        q->intern = NULL;
+    } else if (!q->intern) {
+        q->intern = intern_new();
+    }
+    return !on || q->intern != NULL;
+}
+
+bool q_set_index(queue_t *q, bool on)
+{
+    if (!q || q->head || q->lent || q->backend != Q_BACKEND_LIST)
+        return false;
+
+    if (!on) {
+        strset_free(q->index);
+        q->index = NULL;
+    } else if (!q->index) {
+        q->index = strset_new();
+    }
+    return !on || q->index != NULL;
+}
+
+bool q_set_sort_mode(queue_t *q, q_sort_mode_t mode)
+{
+    if (!q || mode > Q_SORT_ARRAY)
+        return false;
+
+    q->sort_mode = mode;
+    return true;
+}
+
+bool q_set_sort_threads(queue_t *q, int threads)
+{
+    if (!q || threads < 1 || threads > Q_SORT_MAX_THREADS)
+        return false;
+
+    q->sort_threads = threads;
+    return true;
+}
+
+/* Number of bytes taken by an element holding a string of given length */
+static inline size_t ele_size(size_t length)
+{
+    return sizeof(list_ele_t) + length + 1;
+}
+
+/* Pack the first 8 bytes of string s into an integer, for list_ele_t */
+static uint64_t str_prefix(const char *s)
+{
+    uint64_t prefix = 0;
+    for (int i = 0; i < 8; i++) {
+        prefix <<= 8;
+        if (*s)
+            prefix |= (unsigned char) *s++;
+    }
+    return prefix;
+}
+
+/*
+ * Allocate a new list element holding a copy of the first length bytes of
+ * string s.
+ * The string is placed right after the element header, so a single
+ * allocation (and a single free) covers both.
+ * Return NULL if could not allocate space.
+ */
+static list_ele_t *ele_new_n(queue_t *q, const char *s, size_t length)
+{
+    /* With interning, the string goes to the shared table instead */
+    char *shared = NULL;
+    if (q->intern && !(shared = intern_get(q->intern, s, length)))
+        return NULL;
+
+    size_t size = ele_size(shared ? 0 : length);
+    list_ele_t *e = q->arena ? arena_alloc(q->arena, size) : malloc(size);
+    if (!e) {
+        if (shared)
+            intern_put(q->intern, shared);
+        return NULL;
+    }
+
+    if (shared) {
+        e->data[0] = '\0';
+        e->value = shared;
+    } else {
+        memcpy(e->data, s, length);
+        e->data[length] = '\0';
+        e->value = e->data;
+    }
+    e->next = e->prev = NULL;
+    e->length = length;
+    e->prefix = str_prefix(e->value);
+    return e;
+}
+
+/*
+ * Allocate a new list element for string s, taking it over rather than
+ * copying it.
+ * Return NULL if could not allocate space.
+ */
+static list_ele_t *ele_adopt(queue_t *q, char *s)
+{
+    if (q->intern) {
+        /* Equal strings share a single copy, so this one is not needed */
+        list_ele_t *e = ele_new_n(q, s, strlen(s));
+        if (e)
+            free(s);
+        return e;
+    }
+
+    list_ele_t *e = q->arena ? arena_alloc(q->arena, ele_size(0))
+                             : malloc(ele_size(0));
+    if (!e)
+        return NULL;
+
+    e->data[0] = '\0';
+    e->value = s;
+    e->next = e->prev = NULL;
+    e->length = strlen(s);
+    e->prefix = str_prefix(s);
+    q->adopted++;
+    return e;
+}
+
+/*
+ * Allocate a copy of the first length bytes of string s on its own.
+ * Used by backends that keep strings apart from their bookkeeping.
+ * Return NULL if could not allocate space.
+ */
+static char *str_new_n(const char *s, size_t length)
+{
+    char *p = malloc(length + 1);
+    if (!p)
+        return NULL;
+
+    memcpy(p, s, length);
+    p[length] = '\0';
+    return p;
+}
+
+/*
+ * Copy the first length bytes of string s out to sp, as q_remove_head does:
+ * up to bufsize - 1 of them, plus a null terminator.
+ */
+static void str_copy_out(char *sp,
+                         size_t bufsize,
+                         const char *s,
+                         size_t length)
+{
+    if (!sp || !bufsize)
+        return;
+    if (length > bufsize - 1)
+        length = bufsize - 1;
+    memcpy(sp, s, length);
+    sp[length] = '\0';
+}
+
+/* Remove string at head or tail, as q_remove_head does */
+static bool backend_remove(queue_t *q, char *sp, size_t bufsize, bool tail)
+{
+    char *s = backend_pop(q, tail);
+    /* Length is not kept here, but need not be scanned past bufsize */
+    if (sp && bufsize)
+        str_copy_out(sp, bufsize, s, strnlen(s, bufsize - 1));
+    backend_str_free(q, s);
+    (q->size)--;
+    return true;
+}
+
+/* Release element e, which has been unlinked from queue q */
+static void ele_free(queue_t *q, list_ele_t *e)
+{
+    size_t length = e->length;
+    if (e->value != e->data) {
+        if (q->intern) {
+            intern_put(q->intern, e->value);
+        } else {
+            free(e->value);
+            q->adopted--;
+        }
+        length = 0;
+    }
+
+    if (q->arena)
+        arena_recycle(q->arena, e, ele_size(length));
+    else
+        free(e);
+}
+
+/*
+ * Count string s of length len in the index of queue q, if it has one.
+ * Return false if could not allocate space.
+ */
+static bool index_add(queue_t *q, const char *s, size_t len)
+{
+    return !q->index || strset_add(q->index, s, len);
+}
+
+/* Take string s of length len back out of the index of q, if it has one */
+static void index_remove(queue_t *q, const char *s, size_t len)
+{
+    if (q->index)
+        strset_remove(q->index, s, len);
+}
+
+/* Take the strings of the elements chained from e out of the index of q */
+static void index_remove_chain(queue_t *q, list_ele_t *e)
+{
+    for (; q->index && e; e = e->next)
+        strset_remove(q->index, e->value, e->length);
+}
+
+/*
+ * Link element e in at head or tail of list queue q, as seen from outside.
+ * Once reversed, the head of the queue is the tail of the list.
+ */
+static void list_push(queue_t *q, list_ele_t *e, bool tail)
+{
+    if (tail != q->reversed) {
+        e->prev = q->tail;
+        if (q->tail)
+            q->tail->next = e;
+        else
+            q->head = e;
+        q->tail = e;
+    } else {
+        e->next = q->head;
+        if (q->head)
+            q->head->prev = e;
+        else
+            q->tail = e;
+        q->head = e;
+    }
+    (q->size)++;
+}
+
+/* Unlink element e from anywhere in list queue q */
+static void list_unlink(queue_t *q, list_ele_t *e)
+{
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        q->head = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        q->tail = e->prev;
+    e->next = e->prev = NULL;
+    (q->size)--;
+}
+
+/* Unlink the element at head or tail of list queue q, as seen from outside */
+static list_ele_t *list_pop(queue_t *q, bool tail)
+{
+    list_ele_t *e;
+    if (tail != q->reversed) {
+        e = q->tail;
+        q->tail = e->prev;
+        if (q->tail)
+            q->tail->next = NULL;
+        else
+            q->head = NULL;
+    } else {
+        e = q->head;
+        q->head = e->next;
+        if (q->head)
+            q->head->prev = NULL;
+        else
+            q->tail = NULL;
+    }
+    (q->size)--;
+    return e;
+}
+
+/*
+ * Set the back links of elements first .. last, which come right after
+ * element prev, and of the element following them.
+ */
+static void list_set_prev(list_ele_t *first,
+                          list_ele_t *last,
+                          list_ele_t *prev)
+{
+    for (list_ele_t *e = first; prev != last; e = e->next) {
+        e->prev = prev;
+        prev = e;
+    }
+    if (last->next)
+        last->next->prev = last;
+}
+
 /*
  * Attempt to insert element at head of queue.
  * Return true if successful.
@@ -51,273 +493,1415 @@ bool q_insert_head(queue_t *q, char *s)
     /* TODO: What should you do if the q is NULL? */
     if (!q)
         return false;
+    return q_insert_head_n(q, s, strlen(s));
+}
+
+bool q_insert_head_n(queue_t *q, const char *s, size_t len)
+{
+    if (!q)
+        return false;
+
+    if (q->backend != Q_BACKEND_LIST) {
+        char *p = str_new_n(s, len);
+        if (!p)
+            return false;
+        if (!backend_push(q, p, false)) {
+            free(p);
+            return false;
+        }
+        (q->size)++;
+        return true;
+    }
+
+    if (!index_add(q, s, len))
+        return false;
+    list_ele_t *newh = ele_new_n(q, s, len);
+    if (!newh) {
+        index_remove(q, s, len);
+        return false;
+    }
+
+    list_push(q, newh, false);
+    return true;
+}
+
+/*
+ * Attempt to insert element at tail of queue.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ * Argument s points to the string to be stored.
+ * The function must explicitly allocate space and copy the string into it.
+ */
+bool q_insert_tail(queue_t *q, char *s)
+{
+    /* TODO: You need to write the complete code for this function */
+    /* Remember: It should operate in O(1) time */
+    /* TODO: Remove the above comment when you are about to implement. */
+    if (!q)
+        return false;
+    return q_insert_tail_n(q, s, strlen(s));
+}
+
+bool q_insert_tail_n(queue_t *q, const char *s, size_t len)
+{
+    if (!q)
+        return false;
+
+    if (q->backend != Q_BACKEND_LIST) {
+        char *p = str_new_n(s, len);
+        if (!p)
+            return false;
+        if (!backend_push(q, p, true)) {
+            free(p);
+            return false;
+        }
+        (q->size)++;
+        return true;
+    }
+
+    if (!index_add(q, s, len))
+        return false;
+    list_ele_t *newt = ele_new_n(q, s, len);
+    if (!newt) {
+        index_remove(q, s, len);
+        return false;
+    }
+
+    list_push(q, newt, true);
+    return true;
+}
+
+bool q_insert_head_take(queue_t *q, char *s)
+{
+    if (!q)
+        return false;
+
+    if (q->backend != Q_BACKEND_LIST) {
+        if (!backend_push(q, s, false))
+            return false;
+        (q->size)++;
+        return true;
+    }
+
+    /* Should the element not be made, s stays with the caller */
+    size_t len = q->index ? strlen(s) : 0;
+    if (!index_add(q, s, len))
+        return false;
+    list_ele_t *newh = ele_adopt(q, s);
+    if (!newh) {
+        index_remove(q, s, len);
+        return false;
+    }
+
+    list_push(q, newh, false);
+    return true;
+}
+
+bool q_insert_tail_take(queue_t *q, char *s)
+{
+    if (!q)
+        return false;
+
+    if (q->backend != Q_BACKEND_LIST) {
+        if (!backend_push(q, s, true))
+            return false;
+        (q->size)++;
+        return true;
+    }
+
+    /* Should the element not be made, s stays with the caller */
+    size_t len = q->index ? strlen(s) : 0;
+    if (!index_add(q, s, len))
+        return false;
+    list_ele_t *newt = ele_adopt(q, s);
+    if (!newt) {
+        index_remove(q, s, len);
+        return false;
+    }
+
+    list_push(q, newt, true);
+    return true;
+}
+
+/*
+ * Insert n strings one by one into a backend other than Q_BACKEND_LIST.
+ * If one fails, the strings inserted before it are taken back out.
+ */
+static bool backend_push_bulk(queue_t *q,
+                              char **s,
+                              const size_t *len,
+                              int n,
+                              bool tail)
+{
+    for (int i = 0; i < n; i++) {
+        char *p = str_new_n(s[i], len ? len[i] : strlen(s[i]));
+        if (!p || !backend_push(q, p, tail)) {
+            free(p);
+            while (i--)
+                free(backend_pop(q, tail));
+            return false;
+        }
+    }
+    q->size += n;
+    return true;
+}
+
+/*
+ * Build a private chain of elements for the n strings and splice it onto
+ * q with a single update of head or tail.  For the head, each string is
+ * put in front of the previous one, as a run of q_insert_head would do.
+ */
+static bool list_insert_bulk(queue_t *q,
+                             char **s,
+                             const size_t *len,
+                             int n,
+                             bool tail)
+{
+    /* Once reversed, the head of the queue is the tail of the list */
+    tail = tail != q->reversed;
+
+    list_ele_t *first = NULL, *last = NULL;
+    for (int i = 0; i < n; i++) {
+        size_t l = len ? len[i] : strlen(s[i]);
+        bool counted = index_add(q, s[i], l);
+        list_ele_t *e = counted ? ele_new_n(q, s[i], l) : NULL;
+        if (!e) {
+            if (counted)
+                index_remove(q, s[i], l);
+            while (first) {
+                list_ele_t *next = first->next;
+                index_remove(q, first->value, first->length);
+                ele_free(q, first);
+                first = next;
+            }
+            return false;
+        }
+        if (!first) {
+            first = last = e;
+        } else if (tail) {
+            last->next = e;
+            last = e;
+        } else {
+            e->next = first;
+            first = e;
+        }
+    }
+    if (!first)
+        return true;
+
+    list_ele_t *prev = tail ? q->tail : NULL;
+    if (tail) {
+        if (q->tail)
+            q->tail->next = first;
+        else
+            q->head = first;
+        q->tail = last;
+    } else {
+        last->next = q->head;
+        q->head = first;
+        if (!q->tail)
+            q->tail = last;
+    }
+    list_set_prev(first, last, prev);
+    q->size += n;
+    return true;
+}
+
+bool q_insert_head_bulk(queue_t *q, char **s, const size_t *len, int n)
+{
+    if (!q || n < 0)
+        return false;
+    if (q->backend != Q_BACKEND_LIST)
+        return backend_push_bulk(q, s, len, n, false);
+    return list_insert_bulk(q, s, len, n, false);
+}
+
+bool q_insert_tail_bulk(queue_t *q, char **s, const size_t *len, int n)
+{
+    if (!q || n < 0)
+        return false;
+    if (q->backend != Q_BACKEND_LIST)
+        return backend_push_bulk(q, s, len, n, true);
+    return list_insert_bulk(q, s, len, n, true);
+}
+
+/*
+ * Attempt to remove element from head of queue.
+ * Return true if successful.
+ * Return false if queue is NULL or empty.
+ * If sp is non-NULL and an element is removed, copy the removed string to *sp
+ * (up to a maximum of bufsize-1 characters, plus a null terminator.)
+ * The space used by the list element and the string should be freed.
+ */
+bool q_remove_head(queue_t *q, char *sp, size_t bufsize)
+{
+    /* TODO: You need to fix up this code. */
+    /* TODO: Remove the above comment when you are about to implement. */
+    /*Return false if queue is NULL or empty.*/
+    if (!q || !q->size)
+        return false;
+
+    if (q->backend != Q_BACKEND_LIST)
+        return backend_remove(q, sp, bufsize, false);
+
+    /*
+     *If sp is non-NULL and an element is removed, copy the removed string to
+     **sp (up to a maximum of bufsize-1 characters, plus a null terminator.)
+     */
+    list_ele_t *tmp = list_pop(q, false);
+    str_copy_out(sp, bufsize, tmp->value, tmp->length);
+    index_remove(q, tmp->value, tmp->length);
+    ele_free(q, tmp);
+    return true;
+}
+
+bool q_remove_tail(queue_t *q, char *sp, size_t bufsize)
+{
+    if (!q || !q->size)
+        return false;
+
+    if (q->backend != Q_BACKEND_LIST)
+        return backend_remove(q, sp, bufsize, true);
+
+    list_ele_t *tmp = list_pop(q, true);
+    str_copy_out(sp, bufsize, tmp->value, tmp->length);
+    index_remove(q, tmp->value, tmp->length);
+    ele_free(q, tmp);
+    return true;
+}
+
+char *q_peek_head(queue_t *q)
+{
+    if (!q || !q->size)
+        return NULL;
+    if (q->backend == Q_BACKEND_UNROLLED)
+        return unrolled_peek_head(q->unrolled);
+    if (q->ring)
+        return ring_peek_head(q->ring);
+    return (q->reversed ? q->tail : q->head)->value;
+}
+
+char *q_peek_tail(queue_t *q)
+{
+    if (!q || !q->size)
+        return NULL;
+    if (q->backend == Q_BACKEND_UNROLLED)
+        return unrolled_peek_tail(q->unrolled);
+    if (q->ring)
+        return ring_peek_tail(q->ring);
+    return (q->reversed ? q->head : q->tail)->value;
+}
+
+/* Unlink the first k elements of the list, which must hold that many */
+static list_ele_t *list_detach(queue_t *q, int k)
+{
+    if (q->reversed) {
+        /* Take them from the tail, turning the links around on the way */
+        list_ele_t *chain = q->tail, *last = chain;
+        for (int i = 1; i < k; i++) {
+            last->next = last->prev;
+            last = last->next;
+        }
+
+        q->tail = last->prev;
+        last->next = NULL;
+        if (q->tail)
+            q->tail->next = NULL;
+        else
+            q->head = NULL;
+        q->size -= k;
+        index_remove_chain(q, chain);
+        return chain;
+    }
+
+    list_ele_t *chain = q->head, *last = chain;
+    for (int i = 1; i < k; i++)
+        last = last->next;
+
+    q->head = last->next;
+    last->next = NULL;
+    if (q->head)
+        q->head->prev = NULL;
+    else
+        q->tail = NULL;
+    q->size -= k;
+    index_remove_chain(q, chain);
+    return chain;
+}
+
+/*
+ * Prefix marking elements lent out by q_remove_head_bulk.  No string packs
+ * into it, as its only nonzero byte comes after a null.
+ */
+#define LENT_PREFIX 1
+
+int q_remove_head_bulk(queue_t *q, char **sp, int k)
+{
+    if (!q || k <= 0)
+        return 0;
+    if (k > q->size)
+        k = q->size;
+
+    if (q->backend != Q_BACKEND_LIST) {
+        for (int i = 0; i < k; i++)
+            sp[i] = backend_pop(q, false);
+        q->size -= k;
+        return k;
+    }
+
+    /*
+     * Strings are handed out in place, and their elements kept aside until
+     * q_free_strings, as taken over strings do not lead back to them.
+     * The elements kept are linked both ways, to be unlinked in any order,
+     * and marked as lent, their prefix being of no further use.
+     */
+    list_ele_t *chain = list_detach(q, k), *last = chain;
+    list_ele_t *prev = q->lent_tail;
+    for (int i = 0; i < k; i++, prev = last, last = last->next) {
+        sp[i] = last->value;
+        last->prev = prev;
+        last->prefix = LENT_PREFIX;
+        if (!last->next)
+            break;
+    }
+
+    if (q->lent_tail)
+        q->lent_tail->next = chain;
+    else
+        q->lent = chain;
+    q->lent_tail = last;
+    return k;
+}
+
+/* Find the element kept by q_remove_head_bulk on q for string s */
+static list_ele_t *lent_find(queue_t *q, char *s)
+{
+    /* Strings held in data[] lead straight back to their element */
+    if (!q->intern && !q->adopted) {
+        list_ele_t *e = (list_ele_t *) (s - offsetof(list_ele_t, data));
+        return e->value == s && e->prefix == LENT_PREFIX ? e : NULL;
+    }
+
+    /* Strings normally come back in the order they were handed out */
+    list_ele_t *e = q->lent;
+    while (e && e->value != s)
+        e = e->next;
+    return e;
+}
+
+int q_free_strings(queue_t *q, char **sp, int n)
+{
+    if (!q)
+        return 0;
+
+    int freed = 0;
+    for (int i = 0; i < n; i++) {
+        if (q->backend != Q_BACKEND_LIST) {
+            backend_str_free(q, sp[i]);
+            freed++;
+            continue;
+        }
+
+        list_ele_t *e = sp[i] && q->lent ? lent_find(q, sp[i]) : NULL;
+        if (!e)
+            continue;
+        if (e->prev)
+            e->prev->next = e->next;
+        else
+            q->lent = e->next;
+        if (e->next)
+            e->next->prev = e->prev;
+        else
+            q->lent_tail = e->prev;
+        ele_free(q, e);
+        freed++;
+    }
+    return freed;
+}
+
+list_ele_t *q_drain(queue_t *q, int k, int *n)
+{
+    if (n)
+        *n = 0;
+    if (!q || !q->size || k <= 0 || q->backend != Q_BACKEND_LIST)
+        return NULL;
+    if (k > q->size)
+        k = q->size;
+
+    if (n)
+        *n = k;
+    return list_detach(q, k);
+}
+
+void q_release(queue_t *q, list_ele_t *chain)
+{
+    if (!q)
+        return;
+
+    while (chain) {
+        list_ele_t *next = chain->next;
+        ele_free(q, chain);
+        chain = next;
+    }
+}
+
+/*
+ * Return number of elements in queue.
+ * Return 0 if q is NULL or empty
+ */
+int q_size(queue_t *q)
+{
+    /* TODO: You need to write the code for this function */
+    /* Remember: It should operate in O(1) time */
+    /* TODO: Remove the above comment when you are about to implement. */
+    if (!q) {
+        return 0;
+    }
+    return q->size;
+}
+
+/*
+ * Reverse elements in queue
+ * No effect if q is NULL or empty
+ * This function should not allocate or free any list elements
+ * (e.g., by calling q_insert_head, q_insert_tail, or q_remove_head).
+ * It should rearrange the existing ones.
+ */
+void q_reverse(queue_t *q)
+{
+    /* TODO: You need to write the code for this function */
+    /* TODO: Remove the above comment when you are about to implement. */
+    if (!q || q->size <= 1)
+        return;
+
+    if (q->backend == Q_BACKEND_UNROLLED) {
+        unrolled_reverse(q->unrolled);
+        return;
+    }
+    if (q->ring) {
+        ring_reverse(q->ring);
+        return;
+    }
+
+    /* Elements are linked both ways, so just start reading from the tail */
+    q->reversed = !q->reversed;
+}
+
+/* Comparison counts gathered by the comparison sorts */
+typedef struct {
+    size_t compares;
+    size_t fallbacks;
+} sort_ctx_t;
+
+/*
+ * Compare the strings of elements a and b like strcmp.
+ * The cached prefixes settle most comparisons without touching the
+ * strings.  Only when they are equal and the strings go on past them does
+ * the rest of the strings need to be compared.
+ */
+static inline int ele_cmp(const list_ele_t *a,
+                          const list_ele_t *b,
+                          sort_ctx_t *ctx)
+{
+    ctx->compares++;
+    if (a->prefix != b->prefix)
+        return a->prefix < b->prefix ? -1 : 1;
+    /* A zero last byte means both strings ended within the prefix */
+    if (!(a->prefix & 0xff))
+        return 0;
+    /* Interned strings are equal exactly when they are the same */
+    if (a->value == b->value)
+        return 0;
+    ctx->fallbacks++;
+    return strcmp(a->value + 8, b->value + 8);
+}
+
+/* Sorted run of elements, linked through next and NULL-terminated */
+typedef struct {
+    list_ele_t *head, *tail;
+} run_t;
+
+/*
+ * Merge sorted runs a and b into one, keeping equal elements in their
+ * original order.  The tail of the result is whichever run is left over,
+ * so it comes for free.
+ */
+static run_t merge_runs(run_t a, run_t b, sort_ctx_t *ctx)
+{
+    run_t merged;
+    list_ele_t **cursor = &merged.head;
+
+    while (a.head && b.head) {
+        list_ele_t **min =
+            ele_cmp(a.head, b.head, ctx) <= 0 ? &a.head : &b.head;
+        *cursor = *min;
+        cursor = &(*min)->next;
+        *min = (*min)->next;
+    }
+
+    *cursor = a.head ? a.head : b.head;
+    merged.tail = a.head ? a.tail : b.tail;
+    return merged;
+}
+
+/* Number of pending runs needed to sort any list that fits in memory */
+#define MAX_PENDING 64
+
+/*
+ * Bottom-up merge sort.
+ * Elements are taken one at a time, and pending[i] holds a sorted run of
+ * 2^i elements, like the digits of a binary counter.  Adding an element
+ * merges it with the runs it carries into.  No recursion and no scans for
+ * midpoints are needed, and every merge reports the tail of its result.
+ */
+static run_t merge_sort(list_ele_t *list, sort_ctx_t *ctx)
+{
+    run_t pending[MAX_PENDING] = {{NULL, NULL}};
+
+    list_ele_t *e = list;
+    while (e) {
+        run_t run = {e, e};
+        e = e->next;
+        run.head->next = NULL;
+
+        int i = 0;
+        for (; pending[i].head; i++) {
+            run = merge_runs(pending[i], run, ctx);
+            pending[i].head = NULL;
+        }
+        pending[i] = run;
+    }
+
+    /* Smaller runs hold later elements, so fold them in from the right */
+    run_t sorted = {NULL, NULL};
+    for (int i = 0; i < MAX_PENDING; i++) {
+        if (pending[i].head)
+            sorted =
+                sorted.head ? merge_runs(pending[i], sorted, ctx) : pending[i];
+    }
+    return sorted;
+}
+
+/*
+ * Parallel merge sort.
+ * The list is cut into one segment per thread, the segments are sorted
+ * concurrently, and neighbouring segments are then merged pairwise, again
+ * concurrently, until one is left.  As every merge is stable and only
+ * joins adjacent segments, the result is the same as that of merge_sort.
+ */
+
+/* Fewest elements worth handing to a thread of its own */
+#define PARALLEL_CUTOFF 4096
+
+/* Work for one thread: sort run a, or merge it with run b if b is set */
+typedef struct {
+    run_t a, b;
+    run_t out;
+    sort_ctx_t ctx;
+    pthread_t tid;
+    bool spawned;
+} sort_task_t;
+
+static void *sort_worker(void *arg)
+{
+    sort_task_t *t = arg;
+    if (t->b.head)
+        t->out = merge_runs(t->a, t->b, &t->ctx);
+    else
+        t->out = merge_sort(t->a.head, &t->ctx);
+    return NULL;
+}
+
+/*
+ * Carry out n tasks, the first on the calling thread and the others on
+ * threads of their own.  A task whose thread could not be created is done
+ * on the calling thread instead.
+ */
+static void run_tasks(sort_task_t *task, int n, sort_ctx_t *ctx)
+{
+    /* Hold back SIGALRM of the time limit until every worker is joined.
+     * Its handler jumps out of the sort, which must not happen while other
+     * threads are still relinking elements.  New threads inherit the mask,
+     * so the signal stays pending for the calling thread alone.
+     */
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    for (int i = 1; i < n; i++)
+        task[i].spawned =
+            !pthread_create(&task[i].tid, NULL, sort_worker, &task[i]);
+
+    sort_worker(&task[0]);
+    for (int i = 1; i < n; i++) {
+        if (task[i].spawned)
+            pthread_join(task[i].tid, NULL);
+        else
+            sort_worker(&task[i]);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    for (int i = 0; i < n; i++) {
+        ctx->compares += task[i].ctx.compares;
+        ctx->fallbacks += task[i].ctx.fallbacks;
+    }
+}
+
+static run_t parallel_sort(list_ele_t *list,
+                           int size,
+                           int threads,
+                           sort_ctx_t *ctx)
+{
+    int n = size / PARALLEL_CUTOFF;
+    if (n > threads)
+        n = threads;
+    if (n < 2)
+        return merge_sort(list, ctx);
+
+    sort_task_t task[Q_SORT_MAX_THREADS];
+    run_t seg[Q_SORT_MAX_THREADS];
+
+    /* Cut the list into n segments of nearly equal length */
+    for (int i = 0; i < n; i++) {
+        int len = size / n + (i < size % n);
+        seg[i].head = list;
+        for (int j = 1; j < len; j++)
+            list = list->next;
+        seg[i].tail = list;
+        list = list->next;
+        seg[i].tail->next = NULL;
+        task[i].a = seg[i];
+        task[i].b.head = NULL;
+        task[i].ctx = (sort_ctx_t){0, 0};
+    }
+    run_tasks(task, n, ctx);
+    for (int i = 0; i < n; i++)
+        seg[i] = task[i].out;
+
+    while (n > 1) {
+        int m = n / 2;
+        for (int i = 0; i < m; i++) {
+            task[i].a = seg[2 * i];
+            task[i].b = seg[2 * i + 1];
+            task[i].ctx = (sort_ctx_t){0, 0};
+        }
+        run_tasks(task, m, ctx);
+        for (int i = 0; i < m; i++)
+            seg[i] = task[i].out;
+        /* An odd segment out moves up to the next round as it is */
+        if (n % 2)
+            seg[m++] = seg[n - 1];
+        n = m;
+    }
+    return seg[0];
+}
+
+/*
+ * Detach the run of already ordered elements at the start of *list and
+ * advance *list past it.  A run is either non-descending or strictly
+ * descending; the latter is reversed in place, which keeps equal elements
+ * in order since there are none in it.  Store the run length in *len.
+ */
+static run_t next_run(list_ele_t **list, size_t *len, sort_ctx_t *ctx)
+{
+    list_ele_t *head = *list;
+    *len = 1;
+
+    if (head->next && ele_cmp(head, head->next, ctx) > 0) {
+        list_ele_t *rev = head, *cur = head->next;
+        while (cur && ele_cmp(rev, cur, ctx) > 0) {
+            list_ele_t *next = cur->next;
+            cur->next = rev;
+            rev = cur;
+            cur = next;
+            (*len)++;
+        }
+        head->next = NULL;
+        *list = cur;
+        return (run_t){rev, head};
+    }
+
+    list_ele_t *e = head;
+    while (e->next && ele_cmp(e, e->next, ctx) <= 0) {
+        e = e->next;
+        (*len)++;
+    }
+    *list = e->next;
+    e->next = NULL;
+    return (run_t){head, e};
+}
+
+/*
+ * Natural merge sort, in the style of Timsort.
+ * The list is cut into the runs it already contains, which are pushed on
+ * a stack and merged so that run lengths keep decreasing at least as fast
+ * as Fibonacci numbers from the bottom up.  This keeps merges balanced,
+ * and sorted (or reverse sorted) input is handled in one linear pass.
+ */
+static void natural_sort(queue_t *q, sort_ctx_t *ctx)
+{
+    run_t run[MAX_PENDING];
+    size_t len[MAX_PENDING];
+    int n = 0;
+
+    list_ele_t *list = q->head;
+    while (list) {
+        run[n] = next_run(&list, &len[n], ctx);
+        n++;
+
+        /* Restore invariants on the top of the stack */
+        while (n > 1) {
+            int k = n - 2;
+            if ((k > 0 && len[k - 1] <= len[k] + len[k + 1]) ||
+                (k > 1 && len[k - 2] <= len[k - 1] + len[k])) {
+                if (len[k - 1] < len[k + 1])
+                    k--;
+            } else if (len[k] > len[k + 1]) {
+                break;
+            }
+
+            run[k] = merge_runs(run[k], run[k + 1], ctx);
+            len[k] += len[k + 1];
+            if (k + 2 < n) {
+                run[k + 1] = run[k + 2];
+                len[k + 1] = len[k + 2];
+            }
+            n--;
+        }
+    }
+
+    while (n > 1) {
+        run[n - 2] = merge_runs(run[n - 2], run[n - 1], ctx);
+        n--;
+    }
+
+    q->head = run[0].head;
+    q->tail = run[0].tail;
+}
+
+/* Buckets below this size are finished off with insertion sort */
+#define RADIX_CUTOFF 16
+
+/*
+ * Levels of buckets within buckets dealt out before handing over to
+ * merge_sort, which bounds the stack taken by the bucket arrays.
+ */
+#define RADIX_MAX_LEVELS 32
+
+/* Append the chain of elements starting at e to run out */
+static void run_append(run_t *out, list_ele_t *e)
+{
+    if (out->tail)
+        out->tail->next = e;
+    else
+        out->head = e;
+    while (e->next)
+        e = e->next;
+    out->tail = e;
+}
+
+/* Length of the prefix past offset depth shared by all strings in list */
+static size_t common_prefix(list_ele_t *list, size_t depth)
+{
+    /* Bounded by the shortest string first, so that no string is compared
+     * past it, even when longer strings sharing more come earlier.
+     */
+    size_t lcp = list->length - depth;
+    for (list_ele_t *e = list->next; e && lcp; e = e->next) {
+        if (e->length - depth < lcp)
+            lcp = e->length - depth;
+    }
+
+    char *first = list->value + depth;
+    for (list_ele_t *e = list->next; e && lcp; e = e->next) {
+        char *s = e->value + depth;
+        size_t i = 0;
+        while (i < lcp && s[i] == first[i])
+            i++;
+        lcp = i;
+    }
+    return lcp;
+}
+
+/*
+ * MSD radix sort of the n elements chained from list, whose strings all
+ * share their first depth bytes.  The result is appended to run out.
+ *
+ * Elements are dealt into one bucket per byte value at offset depth, and
+ * each bucket is sorted on the following byte.  Bytes shared by all
+ * strings of a bucket are skipped in a single pass up front, so long
+ * common prefixes are neither dealt out byte by byte nor compared over
+ * and over.  Strings ending at depth are all equal and need no further
+ * work.  Equal strings may change their relative order, which is of no
+ * consequence as they are indistinguishable.
+ * Buckets nested more than RADIX_MAX_LEVELS deep, as come of strings
+ * that are prefixes of one another, are sorted by merge_sort instead.
+ */
+static void radix_sort(list_ele_t *list,
+                       int n,
+                       size_t depth,
+                       int level,
+                       run_t *out,
+                       sort_ctx_t *ctx)
+{
+    list_ele_t *bucket[256];
+    int count[256];
+
+    if (n > RADIX_CUTOFF && level == RADIX_MAX_LEVELS) {
+        run_append(out, merge_sort(list, ctx).head);
+        return;
+    }
+
+    if (n > RADIX_CUTOFF) {
+        depth += common_prefix(list, depth);
+        memset(bucket, 0, sizeof(bucket));
+        memset(count, 0, sizeof(count));
+        while (list) {
+            list_ele_t *e = list;
+            unsigned char c = e->value[depth];
+            list = e->next;
+            e->next = bucket[c];
+            bucket[c] = e;
+            count[c]++;
+        }
+
+        if (bucket[0])
+            run_append(out, bucket[0]);
+        for (int c = 1; c < 256; c++) {
+            if (bucket[c])
+                radix_sort(bucket[c], count[c], depth + 1, level + 1, out,
+                           ctx);
+        }
+        return;
+    }
+
+    /* Insertion sort, comparing past the shared prefix only */
+    list_ele_t *sorted = NULL;
+    while (list) {
+        list_ele_t *e = list;
+        list = e->next;
+        list_ele_t **pos = &sorted;
+        while (*pos && strcmp((*pos)->value + depth, e->value + depth) <= 0)
+            pos = &(*pos)->next;
+        e->next = *pos;
+        *pos = e;
+    }
+    if (sorted)
+        run_append(out, sorted);
+}
+
+/*
+ * Array merge sort.
+ * Pointers to the elements are gathered into one array together with
+ * their prefixes, so that comparisons settled by the prefixes walk memory
+ * in order instead of chasing next pointers across the heap.  Short runs
+ * are sorted by insertion, then merged bottom-up back and forth between
+ * the array and a second one, and the list is relinked from the result in
+ * a single pass.  Equal elements keep their order.
+ */
+
+/* Length of the runs sorted by insertion before merging */
+#define ARRAY_CUTOFF 16
+
+typedef struct {
+    uint64_t prefix; /* Copy of that of the element */
+    list_ele_t *ele;
+} sort_key_t;
+
+static inline int key_cmp(const sort_key_t *a,
+                          const sort_key_t *b,
+                          sort_ctx_t *ctx)
+{
+    if (a->prefix != b->prefix) {
+        ctx->compares++;
+        return a->prefix < b->prefix ? -1 : 1;
+    }
+    return ele_cmp(a->ele, b->ele, ctx);
+}
+
+/* Merge sorted keys a[0 .. n - 1] and b[0 .. m - 1] into out */
+static void merge_keys(const sort_key_t *a,
+                       size_t n,
+                       const sort_key_t *b,
+                       size_t m,
+                       sort_key_t *out,
+                       sort_ctx_t *ctx)
+{
+    const sort_key_t *a_end = a + n, *b_end = b + m;
+    while (a < a_end && b < b_end) {
+        /* Advance either cursor without branching on the outcome */
+        bool take_b = key_cmp(b, a, ctx) < 0;
+        *out++ = take_b ? *b : *a;
+        b += take_b;
+        a += !take_b;
+    }
+    memcpy(out, a, (a_end - a) * sizeof(sort_key_t));
+    out += a_end - a;
+    memcpy(out, b, (b_end - b) * sizeof(sort_key_t));
+}
+
+/*
+ * Sort the list of q through an array taken from scratch space.
+ * Return false, leaving the list as it is, if none could be had.
+ */
+static bool array_sort(queue_t *q, sort_ctx_t *ctx)
+{
+    size_t n = q->size;
+    sort_key_t *block = scratch_malloc(2 * n * sizeof(sort_key_t));
+    if (!block)
+        return false;
+
+    sort_key_t *key = block, *tmp = block + n;
+    size_t i = 0;
+    for (list_ele_t *e = q->head; e; e = e->next)
+        key[i++] = (sort_key_t){e->prefix, e};
+
+    for (size_t lo = 0; lo < n; lo += ARRAY_CUTOFF) {
+        size_t hi = lo + ARRAY_CUTOFF < n ? lo + ARRAY_CUTOFF : n;
+        for (size_t j = lo + 1; j < hi; j++) {
+            sort_key_t k = key[j];
+            size_t p = j;
+            for (; p > lo && key_cmp(&key[p - 1], &k, ctx) > 0; p--)
+                key[p] = key[p - 1];
+            key[p] = k;
+        }
+    }
+
+    for (size_t width = ARRAY_CUTOFF; width < n; width *= 2) {
+        for (size_t lo = 0; lo < n; lo += 2 * width) {
+            size_t mid = lo + width < n ? lo + width : n;
+            size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+            merge_keys(key + lo, mid - lo, key + mid, hi - mid, tmp + lo,
+                       ctx);
+        }
+        sort_key_t *t = key;
+        key = tmp;
+        tmp = t;
+    }
+
+    /* Relink both ways at once */
+    list_ele_t *prev = NULL;
+    for (i = 0; i < n; i++) {
+        list_ele_t *e = key[i].ele;
+        e->prev = prev;
+        if (prev)
+            prev->next = e;
+        prev = e;
+    }
+    prev->next = NULL;
+    q->head = key[0].ele;
+    q->tail = prev;
+
+    scratch_free(block);
+    return true;
+}
+
+/*
+ * Sort elements of queue in ascending order
+ * No effect if q is NULL or empty. In addition, if q has only one
+ * element, do nothing.
+ */
+void q_sort(queue_t *q)
+{
+    /* TODO: You need to write the code for this function */
+    /* TODO: Remove the above comment when you are about to implement. */
+    /* No effect if q is NULL or empty.*/
+    if (!q || !q->size)
+        return;
+
+    if (q->backend == Q_BACKEND_UNROLLED) {
+        unrolled_sort(q->unrolled);
+        return;
+    }
+    if (q->ring) {
+        /* Only the pointers move, so a mapped queue stays read-only */
+        ring_sort(q->ring);
+        return;
+    }
+
+    /* The order is about to be redone anyway, so drop the reversal */
+    q->reversed = false;
+
+    sort_ctx_t ctx = {0, 0};
+    /* Without scratch space, the array sort gives way to merge_sort */
+    if (q->sort_mode == Q_SORT_ARRAY && array_sort(q, &ctx)) {
+        q->sort_compares = ctx.compares;
+        q->sort_fallbacks = ctx.fallbacks;
+        return;
+    }
+
+    if (q->sort_mode == Q_SORT_RADIX) {
+        run_t sorted = {NULL, NULL};
+        radix_sort(q->head, q->size, 0, 0, &sorted, &ctx);
+        q->head = sorted.head;
+        q->tail = sorted.tail;
+    } else if (q->sort_mode == Q_SORT_NATURAL) {
+        natural_sort(q, &ctx);
+    } else {
+        run_t sorted;
+        if (q->sort_mode == Q_SORT_PARALLEL)
+            sorted = parallel_sort(q->head, q->size, q->sort_threads, &ctx);
+        else
+            sorted = merge_sort(q->head, &ctx);
+        q->head = sorted.head;
+        q->tail = sorted.tail;
+    }
+    /* The sorts only relink elements forward */
+    list_set_prev(q->head, q->tail, NULL);
+    q->sort_compares = ctx.compares;
+    q->sort_fallbacks = ctx.fallbacks;
+}
+
+/* Restore the max-heap order of keys h[0 .. n - 1] from position i down */
+static void heap_sift_down(sort_key_t *h, int n, int i, sort_ctx_t *ctx)
+{
+    sort_key_t k = h[i];
+    for (int c; (c = 2 * i + 1) < n; i = c) {
+        if (c + 1 < n && key_cmp(&h[c], &h[c + 1], ctx) < 0)
+            c++;
+        if (key_cmp(&k, &h[c], ctx) >= 0)
+            break;
+        h[i] = h[c];
+    }
+    h[i] = k;
+}
+
+/* Restore the max-heap order of keys h[0 .. i] from position i up */
+static void heap_sift_up(sort_key_t *h, int i, sort_ctx_t *ctx)
+{
+    sort_key_t k = h[i];
+    for (int p; i > 0 && key_cmp(&h[p = (i - 1) / 2], &k, ctx) < 0; i = p)
+        h[i] = h[p];
+    h[i] = k;
+}
+
+void q_partial_sort(queue_t *q, int k)
+{
+    if (!q || !q->size || k <= 0)
+        return;
+
+    /* A max-heap keeps the k smallest elements seen so far */
+    sort_key_t *heap = NULL;
+    if (k < q->size && q->backend == Q_BACKEND_LIST)
+        heap = scratch_malloc(k * sizeof(sort_key_t));
+    if (!heap) {
+        q_sort(q);
+        return;
+    }
 
-    list_ele_t *newh;
-    newh = malloc(sizeof(list_ele_t));
-    if (!newh)
-        return false;
-    /* Don't forget to allocate space for the string and copy it */
-    size_t length = strlen(s) + 1;
-    newh->value = (char *) malloc(length * sizeof(char));
-    if (!newh->value) {
-        free(newh);
-        return false;
+    sort_ctx_t ctx = {0, 0};
+    int n = 0;
+    list_ele_t *e = q->reversed ? q->tail : q->head;
+    for (; e; e = q->reversed ? e->prev : e->next) {
+        sort_key_t key = {e->prefix, e};
+        if (n < k) {
+            heap[n] = key;
+            heap_sift_up(heap, n++, &ctx);
+        } else if (key_cmp(&key, &heap[0], &ctx) < 0) {
+            heap[0] = key;
+            heap_sift_down(heap, k, 0, &ctx);
+        }
+    }
+
+    /* Move them to head largest first, so that they end up ascending */
+    while (n) {
+        e = heap[0].ele;
+        heap[0] = heap[--n];
+        heap_sift_down(heap, n, 0, &ctx);
+        list_unlink(q, e);
+        list_push(q, e, false);
     }
-    newh->next = NULL;
+    scratch_free(heap);
+    q->sort_compares = ctx.compares;
+    q->sort_fallbacks = ctx.fallbacks;
+}
 
-    // memset(newh->value, '\0', strlen(s) + 1);
-    // strncpy(newh->value, s, strlen(s));
-    // memcpy(newh->value, s, strlen(s) + 1);
-    snprintf(newh->value, length, "%s", s);
+/* String and its prefix, as compared by q_select */
+typedef struct {
+    uint64_t prefix;
+    char *s;
+} select_key_t;
 
-    // insert head
-    newh->next = q->head;
-    q->head = newh;
-    /* What if either call to malloc returns NULL? */
-    if (!q->tail)
-        q->tail = newh;
-    (q->size)++;
-    return true;
+/* Compare like strcmp, settling what it can by prefixes as ele_cmp does */
+static inline int select_cmp(const select_key_t *a, const select_key_t *b)
+{
+    if (a->prefix != b->prefix)
+        return a->prefix < b->prefix ? -1 : 1;
+    if (!(a->prefix & 0xff))
+        return 0;
+    return strcmp(a->s + 8, b->s + 8);
 }
 
 /*
- * Attempt to insert element at tail of queue.
- * Return true if successful.
- * Return false if q is NULL or could not allocate space.
- * Argument s points to the string to be stored.
- * The function must explicitly allocate space and copy the string into it.
+ * Quickselect over an array of the strings.  Each round partitions the
+ * range holding index k around a random pivot, and goes on with the side
+ * k falls in, until it lands among the elements equal to the pivot.
  */
-bool q_insert_tail(queue_t *q, char *s)
+char *q_select(queue_t *q, int k)
 {
-    /* TODO: You need to write the complete code for this function */
-    /* Remember: It should operate in O(1) time */
-    /* TODO: Remove the above comment when you are about to implement. */
-    if (!q)
-        return false;
+    if (!q || k < 0 || k >= q->size)
+        return NULL;
 
-    list_ele_t *newt;
-    newt = malloc(sizeof(list_ele_t));
-    if (!newt)
-        return false;
-    /* Don't forget to allocate space for the string and copy it */
-    size_t length = strlen(s) + 1;
-    newt->value = (char *) malloc(length * sizeof(char));
-    if (!newt->value) {
-        free(newt);
-        return false;
-    }
+    int n = q->size;
+    select_key_t *key = scratch_malloc(n * sizeof(select_key_t));
+    if (!key)
+        return NULL;
 
-    // memset(newt->value, '\0', strlen(s) + 1);
-    // strncpy(newt->value, s, strlen(s));
-    // memcpy(newt->value, s, strlen(s) + 1);
-    snprintf(newt->value, length, "%s", s);
+    q_iter_t it;
+    char *s;
+    int i = 0;
+    q_iter_init(q, &it);
+    while ((s = q_iter_next(&it)))
+        key[i++] = (select_key_t){str_prefix(s), s};
 
-    // insert tail
-    newt->next = NULL;
-    if (!q->tail) {
-        q->head = newt;
-        q->tail = newt;
-        return true;
+    int lo = 0, hi = n - 1;
+    while (lo < hi) {
+        select_key_t pivot = key[lo + random() % (hi - lo + 1)];
+        int l = lo, r = hi;
+        while (l <= r) {
+            while (select_cmp(&key[l], &pivot) < 0)
+                l++;
+            while (select_cmp(&key[r], &pivot) > 0)
+                r--;
+            if (l <= r) {
+                select_key_t t = key[l];
+                key[l++] = key[r];
+                key[r--] = t;
+            }
+        }
+        /* Now key[lo .. r] <= pivot <= key[l .. hi], equal in between */
+        if (k <= r)
+            hi = r;
+        else if (k >= l)
+            lo = l;
+        else
+            break;
     }
-    q->tail->next = newt;
-    q->tail = newt;
-    (q->size)++;
 
-    return true;
+    s = key[k].s;
+    scratch_free(key);
+    return s;
 }
 
 /*
- * Attempt to remove element from head of queue.
- * Return true if successful.
- * Return false if queue is NULL or empty.
- * If sp is non-NULL and an element is removed, copy the removed string to *sp
- * (up to a maximum of bufsize-1 characters, plus a null terminator.)
- * The space used by the list element and the string should be freed.
+ * Link all elements of list queue q through next in queue order, and
+ * return them as a run.  Back links are left for the caller to restore.
  */
-bool q_remove_head(queue_t *q, char *sp, size_t bufsize)
+static run_t list_chain(queue_t *q)
 {
-    /* TODO: You need to fix up this code. */
-    /* TODO: Remove the above comment when you are about to implement. */
-    /*Return false if queue is NULL or empty.*/
-    if (!q || !q->head)
-        return false;
-    /*
-     *If sp is non-NULL and an element is removed, copy the removed string to
-     **sp (up to a maximum of bufsize-1 characters, plus a null terminator.)
-     */
-    list_ele_t *tmp;
-    tmp = q->head;
-    if (sp) {
-        // strncpy(sp, tmp->value, bufsize - 1);
-        // sp[bufsize - 1] = '\0';
-        snprintf(sp, bufsize, "%s", tmp->value);
-    }
-
-    // remove head
-    q->head = q->head->next;
-    free(tmp->value);
-    free(tmp);
-    (q->size)--;
+    if (!q->reversed)
+        return (run_t){q->head, q->tail};
 
-    return true;
+    for (list_ele_t *e = q->tail; e; e = e->prev)
+        e->next = e->prev;
+    return (run_t){q->tail, q->head};
 }
 
-/*
- * Return number of elements in queue.
- * Return 0 if q is NULL or empty
- */
-int q_size(queue_t *q)
+/* Whether source i of a k-way merge comes before source j */
+static inline bool src_less(const run_t *src, int i, int j, sort_ctx_t *ctx)
 {
-    /* TODO: You need to write the code for this function */
-    /* Remember: It should operate in O(1) time */
-    /* TODO: Remove the above comment when you are about to implement. */
-    if (!q) {
-        return 0;
+    int c = ele_cmp(src[i].head, src[j].head, ctx);
+    return c < 0 || (!c && i < j);
+}
+
+/* Restore the min-heap order of sources heap[0 .. n - 1] from i down */
+static void src_sift_down(int *heap,
+                          int n,
+                          int i,
+                          const run_t *src,
+                          sort_ctx_t *ctx)
+{
+    int s = heap[i];
+    for (int c; (c = 2 * i + 1) < n; i = c) {
+        if (c + 1 < n && src_less(src, heap[c + 1], heap[c], ctx))
+            c++;
+        if (!src_less(src, heap[c], s, ctx))
+            break;
+        heap[i] = heap[c];
     }
-    return q->size;
+    heap[i] = s;
 }
 
 /*
- * Reverse elements in queue
- * No effect if q is NULL or empty
- * This function should not allocate or free any list elements
- * (e.g., by calling q_insert_head, q_insert_tail, or q_remove_head).
- * It should rearrange the existing ones.
+ * K-way merge.
+ * A min-heap holds the queues by their current head element, ties going
+ * to the earlier queue, and the least one gives up its head to the result
+ * on every step.
  */
-void q_reverse(queue_t *q)
+int q_merge(queue_t **qs, int k)
 {
-    /* TODO: You need to write the code for this function */
-    /* TODO: Remove the above comment when you are about to implement. */
-    if (!q || !q->head || q->size == 1)
-        return;
+    if (!qs || k < 1)
+        return -1;
+    for (int i = 0; i < k; i++) {
+        if (!qs[i] || qs[i]->backend != Q_BACKEND_LIST || qs[i]->arena ||
+            qs[i]->intern || qs[i]->index)
+            return -1;
+    }
+
+    sort_ctx_t ctx = {0, 0};
+    run_t merged = {NULL, NULL};
+    int size = 0, adopted = 0;
+    run_t *src = scratch_malloc(k * (sizeof(run_t) + sizeof(int)));
+    if (!src) {
+        /* Fold the queues in one at a time, which needs no space */
+        for (int i = 0; i < k; i++) {
+            run_t r = list_chain(qs[i]);
+            if (r.head)
+                merged = merged.head ? merge_runs(merged, r, &ctx) : r;
+            size += qs[i]->size;
+            adopted += qs[i]->adopted;
+        }
+    } else {
+        int *heap = (int *) (src + k), n = 0;
+        for (int i = 0; i < k; i++) {
+            src[i] = list_chain(qs[i]);
+            if (src[i].head)
+                heap[n++] = i;
+            size += qs[i]->size;
+            adopted += qs[i]->adopted;
+        }
+        for (int i = n / 2 - 1; i >= 0; i--)
+            src_sift_down(heap, n, i, src, &ctx);
 
-    q->tail = q->head;
+        list_ele_t **cursor = &merged.head;
+        while (n) {
+            run_t *r = &src[heap[0]];
+            list_ele_t *e = r->head;
+            r->head = e->next;
+            *cursor = merged.tail = e;
+            cursor = &e->next;
+            if (!r->head)
+                heap[0] = heap[--n];
+            if (n)
+                src_sift_down(heap, n, 0, src, &ctx);
+        }
+        scratch_free(src);
+    }
 
-    list_ele_t *cursor = NULL;
-    list_ele_t *next = NULL;
-    while (q->head) {
-        next = q->head->next;
-        q->head->next = cursor;
-        cursor = q->head;
-        q->head = next;
+    for (int i = 0; i < k; i++) {
+        qs[i]->head = qs[i]->tail = NULL;
+        qs[i]->size = 0;
+        qs[i]->adopted = 0;
+        qs[i]->reversed = false;
     }
-    q->head = cursor;
-    q->tail->next = NULL;
+    queue_t *q = qs[0];
+    q->head = merged.head;
+    q->tail = merged.tail;
+    q->size = size;
+    q->adopted = adopted;
+    if (q->head)
+        list_set_prev(q->head, q->tail, NULL);
+    q->sort_compares = ctx.compares;
+    q->sort_fallbacks = ctx.fallbacks;
+    return size;
 }
 
-/*
- * Sort elements of queue in ascending order
- * No effect if q is NULL or empty. In addition, if q has only one
- * element, do nothing.
- */
-void split_list(list_ele_t **head, list_ele_t **list1, list_ele_t **list2)
+bool q_contains(queue_t *q, const char *s)
 {
-    list_ele_t **slow = list1;
-    list_ele_t **fast = list2;
+    if (!q)
+        return false;
+    if (q->index)
+        return strset_count(q->index, s, strlen(s)) > 0;
 
-    while ((*fast) && (*fast)->next) {
-        *slow = (*slow)->next;
-        *fast = (*fast)->next->next;
-    }
-    // slow is at the midnode
+    q_iter_t it;
+    char *t;
+    q_iter_init(q, &it);
+    while ((t = q_iter_next(&it)))
+        if (!strcmp(t, s))
+            return true;
+    return false;
+}
 
-    *list2 = (*slow)->next;
-    // Split actually
-    (*slow)->next = NULL;
+int q_count(queue_t *q, const char *s)
+{
+    if (!q)
+        return 0;
+    if (q->index)
+        return strset_count(q->index, s, strlen(s));
 
-    *list1 = *head;
+    q_iter_t it;
+    char *t;
+    int n = 0;
+    q_iter_init(q, &it);
+    while ((t = q_iter_next(&it)))
+        n += !strcmp(t, s);
+    return n;
 }
 
-void merge_list(list_ele_t **head, list_ele_t **list1, list_ele_t **list2)
+/*
+ * Removal of duplicates.
+ * Going from the tail towards the head, an element whose string is still
+ * counted more than once has an equal one closer to the head, so it goes.
+ * By the time the first of each string is reached, it is counted once.
+ */
+int q_dedup(queue_t *q)
 {
-    list_ele_t **cursor = head;
+    if (!q || q->backend != Q_BACKEND_LIST)
+        return -1;
 
-    while ((*list1) && (*list2)) {
-        if (strcmp((*list1)->value, (*list2)->value) < 0) {
-            *cursor = *list1;
-            *list1 = (*list1)->next;
-        } else {
-            *cursor = *list2;
-            *list2 = (*list2)->next;
+    strset_t *counts = q->index;
+    if (!counts) {
+        if (!(counts = strset_new()))
+            return -1;
+        for (list_ele_t *e = q->head; e; e = e->next) {
+            if (!strset_add(counts, e->value, e->length)) {
+                strset_free(counts);
+                return -1;
+            }
         }
-        cursor = &((*cursor)->next);
     }
-    // avoid dropped off
-    if (*list1)
-        *cursor = *list1;
-    if (*list2)
-        *cursor = *list2;
+
+    int removed = 0;
+    list_ele_t *e = q->reversed ? q->head : q->tail;
+    while (e) {
+        list_ele_t *next = q->reversed ? e->next : e->prev;
+        if (strset_count(counts, e->value, e->length) > 1) {
+            strset_remove(counts, e->value, e->length);
+            list_unlink(q, e);
+            ele_free(q, e);
+            removed++;
+        }
+        e = next;
+    }
+    if (counts != q->index)
+        strset_free(counts);
+    return removed;
 }
 
-void merge_sort(list_ele_t **head)
+void q_iter_init(queue_t *q, q_iter_t *it)
 {
-    // Base case
-    if (!(*head) || !(*head)->next)
+    it->q = q;
+    it->node = NULL;
+    it->idx = 0;
+    if (!q)
         return;
 
-    // Splitting list
-    list_ele_t *list1 = *head;
-    list_ele_t *list2 = (*head)->next;
-
-    split_list(head, &list1, &list2);
-
-    // Recursive sorting two list
-    merge_sort(&(list1));
-    merge_sort(&(list2));
-
-    // Merge sorted lists
-    merge_list(head, &list1, &list2);
+    if (q->backend == Q_BACKEND_UNROLLED) {
+        unrolled_iter_init(q->unrolled, it);
+    } else if (q->ring) {
+        ring_iter_init(q->ring, it);
+    } else {
+        /* For a list, idx tells which way to go */
+        it->node = q->reversed ? q->tail : q->head;
+        it->idx = q->reversed;
+    }
 }
 
-// void merge_sort1(list_ele_t **head)
-// {
-//     if (!(*head) || !((*head)->next))
-//         return;
-
-//     list_ele_t *l1 = (*head)->next;
-//     list_ele_t *l2 = *head;
-
-//     while (l1 && l1->next) {
-//         l2 = l2->next;
-//         l1 = l1->next->next;
-//     }
-//     l1 = l2->next;
-//     l2->next = NULL;
-//     l2 = *head;
-
-//     merge_sort1(&l2);
-//     merge_sort1(&l1);
-
-//     *head = NULL;
-//     list_ele_t **tmp = head;
-
-//     while (l1 && l2) {
-//         if (strcmp(l1->value, l2->value) < 0) {
-//             *tmp = l1;
-//             l1 = l1->next;
-//         } else {
-//             *tmp = l2;
-//             l2 = l2->next;
-//         }
-//         tmp = &((*tmp)->next);
-//     }
-
-//     *tmp = l1 ? l1 : l2;
-// }
-
-void q_sort(queue_t *q)
+char *q_iter_next(q_iter_t *it)
 {
-    /* TODO: You need to write the code for this function */
-    /* TODO: Remove the above comment when you are about to implement. */
-    /* No effect if q is NULL or empty.*/
-    if (!q || !q->head)
-        return;
+    if (!it->q)
+        return NULL;
 
-    merge_sort(&q->head);
-    // merge_sort1(&q->head);
+    if (it->q->backend == Q_BACKEND_UNROLLED)
+        return unrolled_iter_next(it);
+    if (it->q->ring)
+        return ring_iter_next(it->q->ring, it);
 
-    while (q->tail->next)
-        q->tail = q->tail->next;
+    list_ele_t *e = it->node;
+    if (!e)
+        return NULL;
+    it->node = it->idx ? e->prev : e->next;
+    return e->value;
 }
 
 // void q_print(queue_t *q)
@@ -364,3 +1948,591 @@ void q_sort(queue_t *q)
 
 //     return 0;
 // }
+
+/*
+ * Start of a snapshot written by q_dump.  The strings follow in queue
+ * order, each as a 4-byte length, that many bytes and a null terminator,
+ * so that q_map can hand them out in place.
+ * Numbers are in host byte order.
+ */
+typedef struct {
+    char magic[8];
+    uint64_t count; /* Of strings */
+    uint64_t bytes; /* Taken by the strings, without lengths or terminators */
+} dump_header_t;
+
+#define DUMP_MAGIC "lab0-q1"
+
+/* Size of the buffer q_dump gathers small writes in */
+#define DUMP_BUFSIZE (64 * 1024)
+
+/* Write all n bytes at p to fd, retrying after partial writes */
+static bool write_all(int fd, const void *p, size_t n)
+{
+    const char *b = p;
+    while (n) {
+        ssize_t w = write(fd, b, n);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return false;
+        b += w;
+        n -= w;
+    }
+    return true;
+}
+
+/* Read exactly n bytes from fd to p.  Running into end of file fails. */
+static bool read_all(int fd, void *p, size_t n)
+{
+    char *b = p;
+    while (n) {
+        ssize_t r = read(fd, b, n);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        b += r;
+        n -= r;
+    }
+    return true;
+}
+
+/* Read exactly n bytes at offset pos of fd to p */
+static bool pread_all(int fd, void *p, size_t n, off_t pos)
+{
+    char *b = p;
+    while (n) {
+        ssize_t r = pread(fd, b, n, pos);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        b += r;
+        n -= r;
+        pos += r;
+    }
+    return true;
+}
+
+/*
+ * Return the string of the snapshot record at *p, store its length in *len
+ * and step *p past it.
+ * Return NULL if the record runs past end or lacks its terminator.
+ */
+static char *dump_record(char **p, const char *end, size_t *len)
+{
+    uint32_t l;
+    if ((size_t) (end - *p) < sizeof(l))
+        return NULL;
+    memcpy(&l, *p, sizeof(l));
+
+    char *s = *p + sizeof(l);
+    if ((size_t) (end - s) <= l || s[l])
+        return NULL;
+    *p = s + l + 1;
+    *len = l;
+    return s;
+}
+
+/* Buffer gathering small writes to a file */
+typedef struct {
+    int fd;
+    char *buf;
+    size_t size, used;
+    uint64_t flushed; /* Bytes written to fd so far */
+} out_buf_t;
+
+/* Write out the bytes gathered in o */
+static bool out_flush(out_buf_t *o)
+{
+    if (!write_all(o->fd, o->buf, o->used))
+        return false;
+    o->flushed += o->used;
+    o->used = 0;
+    return true;
+}
+
+/* Add n bytes at p to o, flushing it as needed */
+static bool out_append(out_buf_t *o, const void *p, size_t n)
+{
+    if (o->used + n > o->size && !out_flush(o))
+        return false;
+    if (n > o->size) {
+        o->flushed += n;
+        return write_all(o->fd, p, n);
+    }
+    memcpy(o->buf + o->used, p, n);
+    o->used += n;
+    return true;
+}
+
+bool q_dump(queue_t *q, int fd)
+{
+    if (!q)
+        return false;
+
+    dump_header_t h = {DUMP_MAGIC, q->size, 0};
+    q_iter_t it;
+    char *s;
+    q_iter_init(q, &it);
+    while ((s = q_iter_next(&it))) {
+        size_t len = strlen(s);
+        if (len > UINT32_MAX)
+            return false;
+        h.bytes += len;
+    }
+
+    char buf[DUMP_BUFSIZE];
+    out_buf_t o = {fd, buf, sizeof(buf), 0, 0};
+    if (!out_append(&o, &h, sizeof(h)))
+        return false;
+    q_iter_init(q, &it);
+    while ((s = q_iter_next(&it))) {
+        uint32_t len = strlen(s);
+        if (!out_append(&o, &len, sizeof(len)) || !out_append(&o, s, len + 1))
+            return false;
+    }
+    return out_flush(&o);
+}
+
+int q_load(queue_t *q, int fd)
+{
+    if (!q)
+        return -1;
+
+    struct stat st;
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    if (pos < 0 || fstat(fd, &st))
+        return -1;
+
+    /* Sizes in the header are only trusted as far as the file bears them
+     * out, lest a corrupt one ask for more space than there is.
+     */
+    dump_header_t h;
+    uint64_t left = st.st_size - pos - sizeof(h);
+    if ((uint64_t) st.st_size < pos + sizeof(h) ||
+        !read_all(fd, &h, sizeof(h)) ||
+        memcmp(h.magic, DUMP_MAGIC, sizeof(h.magic)) ||
+        h.count > (uint64_t) (INT_MAX - q->size) || h.bytes > left ||
+        h.count * (sizeof(uint32_t) + 1) > left - h.bytes)
+        return -1;
+
+    /* One block holds the lengths, the strings, and pointers to them, so
+     * that the whole body of the snapshot can be read at once.
+     */
+    int n = h.count;
+    size_t body = n * (sizeof(uint32_t) + 1) + h.bytes;
+    size_t *len = malloc(n * (sizeof(size_t) + sizeof(char *)) + body);
+    if (!len)
+        return -1;
+
+    char **str = (char **) (len + n);
+    char *p = (char *) (str + n), *end = p + body;
+    bool ok = read_all(fd, p, body);
+    for (int i = 0; ok && i < n; i++)
+        ok = (str[i] = dump_record(&p, end, &len[i])) != NULL;
+    ok = ok && p == end && q_insert_tail_bulk(q, str, len, n);
+    free(len);
+    return ok ? n : -1;
+}
+
+int q_map(queue_t *q, int fd)
+{
+    struct stat st;
+    if (!q || q->size || q->lent || q->arena || q->intern || q->index ||
+        fstat(fd, &st) || (size_t) st.st_size < sizeof(dump_header_t))
+        return -1;
+
+    size_t size = st.st_size;
+    char *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED)
+        return -1;
+
+    dump_header_t h;
+    memcpy(&h, base, sizeof(h));
+    ring_t *r = NULL;
+    bool ok = !memcmp(h.magic, DUMP_MAGIC, sizeof(h.magic)) &&
+              h.count <= INT_MAX && (r = ring_new());
+    char *p = base + sizeof(h), *end = base + size;
+    for (uint64_t i = 0; ok && i < h.count; i++) {
+        size_t len;
+        char *s = dump_record(&p, end, &len);
+        ok = s && ring_push_tail(r, s);
+    }
+    if (!ok || p != end) {
+        ring_free(r);
+        munmap(base, size);
+        return -1;
+    }
+
+    /* Drop the previous representation, known to be empty */
+    unrolled_free(q->unrolled);
+    ring_free(q->ring);
+    map_release(q);
+    q->unrolled = NULL;
+    q->ring = r;
+    q->map = base;
+    q->map_size = size;
+    q->backend = Q_BACKEND_MAPPED;
+    q->size = h.count;
+    return q->size;
+}
+
+/*
+ * External sort.
+ * Runs holding up to budget bytes of records are cut from the head of the
+ * queue, sorted by merge_sort, and written to a spill file as records of a
+ * 32-bit length followed by the bytes of the string.  The runs are then
+ * read back through buffers sharing the budget, and merged with a heap as
+ * in q_merge.  While there are more runs than buffers, passes merging
+ * groups of them into a new spill file come first.
+ * Sorting into a file frees the elements once spilled.  Sorting in place
+ * keeps them instead, each record carrying the address of its element
+ * after the string, so that the last merge relinks elements rather than
+ * allocating new ones, and cannot fail halfway for want of memory.
+ */
+
+/* Directory spill files are made in.  Can be overridden at build time. */
+#ifndef Q_SPILL_DIR
+#define Q_SPILL_DIR "/tmp"
+#endif
+
+/* Smallest buffer worth reading a run through */
+#define SPILL_MIN_BUFSIZE 4096
+
+/* Run being read back from a spill file */
+typedef struct {
+    off_t pos, end; /* Part of the run not read yet */
+    char *buf;
+    size_t fill, at;  /* Bytes in buf, and where the next record starts */
+    const char *str; /* Current string, NULL once the run is used up */
+    uint32_t len;
+    list_ele_t *ele; /* Element holding str, if kept */
+} spill_run_t;
+
+/* State of an external sort */
+typedef struct {
+    int fd;     /* Spill file holding the runs */
+    off_t *run; /* Where each run starts, then where the last one ends */
+    int nruns;
+    spill_run_t *rd; /* Runs being merged */
+    int *heap;
+    int fanin;  /* Most runs merged at once */
+    char *bufs; /* One buffer of bufsize per run merged */
+    size_t bufsize;
+    out_buf_t out;   /* Where records go, unless into queue q */
+    queue_t *q;
+    bool terminate; /* Whether records end in a null, as those of q_dump */
+    bool keep;      /* Whether elements stay, their address ending records */
+    list_ele_t *kept; /* Elements spilled so far, linked through prev */
+    sort_ctx_t ctx;
+} spill_t;
+
+/* Create a spill file, which goes away once closed */
+static int spill_open()
+{
+    char path[] = Q_SPILL_DIR "/lab0-spill-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd >= 0)
+        unlink(path);
+    return fd;
+}
+
+/* Move the unread bytes of run r to the front of its buffer, and top up */
+static bool spill_fill(spill_run_t *r, int fd, size_t bufsize)
+{
+    size_t have = r->fill - r->at;
+    memmove(r->buf, r->buf + r->at, have);
+    size_t n = bufsize - have;
+    if ((off_t) n > r->end - r->pos)
+        n = r->end - r->pos;
+    if (n && !pread_all(fd, r->buf + have, n, r->pos))
+        return false;
+    r->pos += n;
+    r->fill = have + n;
+    r->at = 0;
+    return true;
+}
+
+/*
+ * Step run r of s on to its next record, which always fits in a buffer.
+ * Return false if the spill file could not be read or is cut short.
+ */
+static bool spill_next(spill_t *s, spill_run_t *r)
+{
+    uint32_t len;
+    if (r->fill - r->at < sizeof(len) && !spill_fill(r, s->fd, s->bufsize))
+        return false;
+    if (r->fill == r->at) {
+        r->str = NULL;
+        return true;
+    }
+    if (r->fill - r->at < sizeof(len))
+        return false;
+
+    memcpy(&len, r->buf + r->at, sizeof(len));
+    size_t size = sizeof(len) + len + (s->keep ? sizeof(r->ele) : 0);
+    if (r->fill - r->at < size &&
+        (!spill_fill(r, s->fd, s->bufsize) || r->fill < size))
+        return false;
+    r->str = r->buf + r->at + sizeof(len);
+    r->len = len;
+    if (s->keep)
+        memcpy(&r->ele, r->str + len, sizeof(r->ele));
+    r->at += size;
+    return true;
+}
+
+/* Whether the current string of run i comes before that of run j */
+static bool spill_less(spill_t *s, int i, int j)
+{
+    const spill_run_t *a = &s->rd[i], *b = &s->rd[j];
+    s->ctx.compares++;
+    int c = memcmp(a->str, b->str, a->len < b->len ? a->len : b->len);
+    if (!c)
+        c = (a->len > b->len) - (a->len < b->len);
+    return c < 0 || (!c && i < j);
+}
+
+/* Restore the min-heap order of runs heap[0 .. n - 1] of s from i down */
+static void spill_sift_down(spill_t *s, int n, int i)
+{
+    int r = s->heap[i];
+    for (int c; (c = 2 * i + 1) < n; i = c) {
+        if (c + 1 < n && spill_less(s, s->heap[c + 1], s->heap[c]))
+            c++;
+        if (!spill_less(s, s->heap[c], r))
+            break;
+        s->heap[i] = s->heap[c];
+    }
+    s->heap[i] = r;
+}
+
+/*
+ * Pass string str of length len, held by element e, on to the output of s.
+ * Into queue q goes e itself, linked through next alone, as the back
+ * links of kept elements are in use until the sort is over.
+ */
+static bool spill_emit(spill_t *s,
+                       const char *str,
+                       uint32_t len,
+                       list_ele_t *e)
+{
+    if (s->q) {
+        e->next = NULL;
+        if (s->q->tail)
+            s->q->tail->next = e;
+        else
+            s->q->head = e;
+        s->q->tail = e;
+        s->q->size++;
+        return true;
+    }
+    return out_append(&s->out, &len, sizeof(len)) &&
+           out_append(&s->out, str, len) &&
+           (!s->terminate || out_append(&s->out, "", 1)) &&
+           (!s->keep || out_append(&s->out, &e, sizeof(e)));
+}
+
+/* Merge runs lo .. hi - 1 of s into its output */
+static bool spill_merge(spill_t *s, int lo, int hi)
+{
+    int n = 0;
+    for (int i = 0; i < hi - lo; i++) {
+        spill_run_t *r = &s->rd[i];
+        *r = (spill_run_t){s->run[lo + i], s->run[lo + i + 1],
+                           s->bufs + i * s->bufsize, 0, 0, NULL, 0, NULL};
+        if (!spill_next(s, r))
+            return false;
+        if (r->str)
+            s->heap[n++] = i;
+    }
+    for (int i = n / 2 - 1; i >= 0; i--)
+        spill_sift_down(s, n, i);
+
+    while (n) {
+        spill_run_t *r = &s->rd[s->heap[0]];
+        if (!spill_emit(s, r->str, r->len, r->ele) || !spill_next(s, r))
+            return false;
+        if (!r->str)
+            s->heap[0] = s->heap[--n];
+        if (n)
+            spill_sift_down(s, n, 0);
+    }
+    return true;
+}
+
+/*
+ * Cut the chain of elements at *rest into runs of up to budget bytes of
+ * records, write them sorted to the spill file of s, and free them, or
+ * add them to those kept by s.
+ * Return false if a run could not be written, leaving its elements and
+ * those after it at *rest.
+ */
+static bool spill_runs(spill_t *s,
+                       queue_t *q,
+                       list_ele_t **rest,
+                       size_t budget)
+{
+    while (*rest) {
+        list_ele_t *last = *rest;
+        size_t bytes = sizeof(uint32_t) + last->length;
+        while (last->next &&
+               bytes + sizeof(uint32_t) + last->next->length <= budget) {
+            last = last->next;
+            bytes += sizeof(uint32_t) + last->length;
+        }
+        list_ele_t *chunk = *rest;
+        *rest = last->next;
+        last->next = NULL;
+
+        run_t sorted = merge_sort(chunk, &s->ctx);
+        s->run[s->nruns] = s->out.flushed + s->out.used;
+        for (list_ele_t *e = sorted.head; e; e = e->next) {
+            if (!spill_emit(s, e->value, e->length, e)) {
+                sorted.tail->next = *rest;
+                *rest = sorted.head;
+                return false;
+            }
+        }
+        s->nruns++;
+        while (sorted.head) {
+            list_ele_t *e = sorted.head;
+            sorted.head = e->next;
+            if (s->keep) {
+                e->prev = s->kept;
+                s->kept = e;
+            } else {
+                index_remove(q, e->value, e->length);
+                ele_free(q, e);
+            }
+        }
+    }
+    s->run[s->nruns] = s->out.flushed + s->out.used;
+    return out_flush(&s->out);
+}
+
+int q_sort_external(queue_t *q, size_t budget, int fd)
+{
+    if (!q || q->backend != Q_BACKEND_LIST)
+        return -1;
+
+    /* Size up the strings, to lay out the runs and buffers up front */
+    size_t longest = 0;
+    uint64_t bytes = 0;
+    for (list_ele_t *e = q->head; e; e = e->next) {
+        if (e->length > longest)
+            longest = e->length;
+        bytes += e->length;
+    }
+    /* Records are handled whole, so buffers must hold the longest one */
+    size_t bufsize = sizeof(uint32_t) + longest + 1 + sizeof(list_ele_t *);
+    if (bufsize < SPILL_MIN_BUFSIZE)
+        bufsize = SPILL_MIN_BUFSIZE;
+    if (longest > UINT32_MAX || budget < 4 * bufsize)
+        return -1;
+
+    /* Every run but the last holds more than budget - bufsize bytes */
+    uint64_t total = bytes + (uint64_t) q->size * sizeof(uint32_t);
+    size_t maxruns = total / (budget - bufsize) + 1;
+    size_t table = (maxruns + 1) * sizeof(off_t);
+    size_t per_run = bufsize + sizeof(spill_run_t) + sizeof(int);
+    if (table + 3 * per_run > budget)
+        return -1;
+    size_t fanin = (budget - table - bufsize) / per_run;
+    if (fanin > maxruns)
+        fanin = maxruns < 2 ? 2 : maxruns;
+    /* Share out what is left between the buffers */
+    bufsize = (budget - table - fanin * (sizeof(spill_run_t) + sizeof(int))) /
+              (fanin + 1);
+
+    char *block = scratch_malloc(budget);
+    if (!block)
+        return -1;
+    spill_t s = {.run = (off_t *) block,
+                 .fanin = fanin,
+                 .bufsize = bufsize,
+                 .keep = fd < 0};
+    s.rd = (spill_run_t *) (block + table);
+    s.heap = (int *) (s.rd + fanin);
+    s.bufs = (char *) (s.heap + fanin);
+    char *outbuf = s.bufs + fanin * bufsize;
+    s.fd = spill_open();
+    if (s.fd < 0) {
+        scratch_free(block);
+        return -1;
+    }
+    s.out = (out_buf_t){s.fd, outbuf, bufsize, 0, 0};
+
+    int n = q->size;
+    list_ele_t *rest = list_chain(q).head;
+    q->head = q->tail = NULL;
+    q->size = 0;
+    q->reversed = false;
+    bool ok = spill_runs(&s, q, &rest, budget);
+
+    /* Merge groups of runs into a new spill file until few enough remain */
+    while (ok && s.nruns > s.fanin) {
+        int next = spill_open();
+        s.out = (out_buf_t){next, outbuf, bufsize, 0, 0};
+        int groups = 0;
+        ok = next >= 0;
+        for (int lo = 0; ok && lo < s.nruns; lo += s.fanin) {
+            off_t start = s.out.flushed + s.out.used;
+            int hi = lo + s.fanin < s.nruns ? lo + s.fanin : s.nruns;
+            ok = spill_merge(&s, lo, hi);
+            /* Runs before lo + s.fanin have been read by now */
+            s.run[groups++] = start;
+        }
+        s.run[groups] = s.out.flushed + s.out.used;
+        ok = ok && out_flush(&s.out);
+        close(s.fd);
+        s.fd = next;
+        s.nruns = groups;
+    }
+
+    if (ok && fd < 0) {
+        s.q = q;
+        ok = spill_merge(&s, 0, s.nruns);
+    } else if (ok) {
+        dump_header_t h = {DUMP_MAGIC, n, bytes};
+        s.out = (out_buf_t){fd, outbuf, bufsize, 0, 0};
+        s.terminate = true;
+        ok = out_append(&s.out, &h, sizeof(h)) &&
+             spill_merge(&s, 0, s.nruns) && out_flush(&s.out);
+    }
+    if (s.fd >= 0)
+        close(s.fd);
+    scratch_free(block);
+
+    if (!ok) {
+        /* Drop what the last merge made of the kept elements, and link
+         * them all back in, run after run, ahead of any not spilled.
+         */
+        q->head = q->tail = NULL;
+        q->size = 0;
+        for (list_ele_t *e = s.kept, *prev; e; e = prev) {
+            prev = e->prev;
+            e->next = q->head;
+            q->head = e;
+            if (!q->tail)
+                q->tail = e;
+            q->size++;
+        }
+    }
+    /* Put back what could not be spilled */
+    for (; rest; rest = rest->next) {
+        if (q->tail)
+            q->tail->next = rest;
+        else
+            q->head = rest;
+        q->tail = rest;
+        q->size++;
+    }
+    if (q->head)
+        list_set_prev(q->head, q->tail, NULL);
+    q->sort_compares = s.ctx.compares;
+    q->sort_fallbacks = s.ctx.fallbacks;
+    return ok ? n : -1;
+}
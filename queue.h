@@ -5,23 +5,71 @@
  * This program implements a queue supporting both FIFO and LIFO
  * operations.
  *
- * It uses a singly-linked list to represent the set of queue elements
+ * It uses a doubly-linked list to represent the set of queue elements
  */
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "intern.h"
+#include "strset.h"
 
 /* Data structure declarations */
 
-/* Linked list element (You shouldn't need to change this) */
+/*
+ * Linked list element.
+ * The string is stored inline right after the element header, so that
+ * each element takes a single allocation.
+ */
 typedef struct ELE {
     /* Pointer to array holding string.
-     * This array needs to be explicitly allocated and freed
+     * It normally points at data[] below and is released along with the
+     * element itself.  Strings taken over by q_insert_head_take and
+     * q_insert_tail_take live apart and are freed on their own, and
+     * interned strings are shared through the table of the queue.
      */
     char *value;
     struct ELE *next;
+    struct ELE *prev; /* Only kept up to date within a queue */
+    size_t length; /* Of the string, not counting the null terminator */
+    /* First 8 bytes of the string, big-endian and zero padded, so that
+     * comparing prefixes as integers orders them like strcmp does.
+     */
+    uint64_t prefix;
+    char data[]; /* Inline string storage */
 } list_ele_t;
 
+/* Ways of representing the elements of a queue */
+typedef enum {
+    Q_BACKEND_LIST,     /* Doubly-linked list of list_ele_t */
+    Q_BACKEND_UNROLLED, /* Linked list of chunks holding many strings each */
+    Q_BACKEND_RING,     /* Growable circular array of strings */
+    Q_BACKEND_MAPPED,   /* Read-only view of a snapshot file, see q_map */
+} q_backend_t;
+
+/* Backend used by q_new.  Can be overridden at build time. */
+#ifndef Q_DEFAULT_BACKEND
+#define Q_DEFAULT_BACKEND Q_BACKEND_LIST
+#endif
+
+/* Algorithms q_sort can use on Q_BACKEND_LIST */
+typedef enum {
+    Q_SORT_MERGE,   /* Bottom-up merge sort */
+    Q_SORT_NATURAL, /* Merge presorted runs, for partly sorted input */
+    Q_SORT_RADIX,   /* MSD radix sort, for strings with long common prefixes */
+    Q_SORT_PARALLEL, /* Merge sort split over several threads */
+    Q_SORT_ARRAY,    /* Merge sort of an array of pointers to the elements */
+} q_sort_mode_t;
+
+/* Threads used by Q_SORT_PARALLEL, by default and at most */
+#define Q_SORT_DEFAULT_THREADS 4
+#define Q_SORT_MAX_THREADS 64
+
+typedef struct UNROLLED unrolled_t;
+typedef struct RING ring_t;
+
 /* Queue structure */
 typedef struct {
     list_ele_t *head; /* Linked list of elements */
@@ -31,8 +79,38 @@ typedef struct {
     list_ele_t *tail;
     int size;
     /* TODO: Remove the above comment when you are about to implement. */
+    bool reversed; /* Whether the list is read from tail to head */
+    int adopted; /* Elements whose string lives outside data[] */
+    /* Elements handed out by q_remove_head_bulk, until q_free_strings */
+    list_ele_t *lent, *lent_tail;
+    arena_t *arena;   /* Allocator for elements in arena mode, else NULL */
+    intern_t *intern; /* Shared strings in interning mode, else NULL */
+    strset_t *index;  /* Counts of the strings in index mode, else NULL */
+    q_backend_t backend;
+    unrolled_t *unrolled; /* Elements when using Q_BACKEND_UNROLLED */
+    /* Elements when using Q_BACKEND_RING, or Q_BACKEND_MAPPED, where they
+     * point into the mapping below.
+     */
+    ring_t *ring;
+    void *map; /* Snapshot file mapped by q_map, else NULL */
+    size_t map_size;
+    q_sort_mode_t sort_mode;
+    int sort_threads; /* Threads used by Q_SORT_PARALLEL */
+    /* Statistics of the last q_sort */
+    size_t sort_compares;  /* Element comparisons made */
+    size_t sort_fallbacks; /* Those that had to look past the prefix */
 } queue_t;
 
+/*
+ * Cursor for walking through a queue from head to tail.
+ * Fields are private to the queue implementation.
+ */
+typedef struct {
+    queue_t *q;
+    void *node;
+    int idx;
+} q_iter_t;
+
 /* Operations on queue */
 
 /*
@@ -47,6 +125,67 @@ queue_t *q_new();
  */
 void q_free(queue_t *q);
 
+/*
+ * Switch queue to another representation.
+ * Q_BACKEND_MAPPED can only be entered through q_map.
+ * Return true if successful.
+ * Return false if q is NULL, q is not empty or has strings lent out by
+ * q_remove_head_bulk, the representation does not support the modes
+ * enabled on q, or could not allocate space.
+ */
+bool q_set_backend(queue_t *q, q_backend_t backend);
+
+/*
+ * Turn arena mode on or off.
+ * In arena mode, elements are carved out of slabs owned by the queue and
+ * removed elements are recycled by later insertions, so q_free releases
+ * the whole queue in time proportional to the number of slabs.
+ * Only available with Q_BACKEND_LIST.
+ * Return true if successful.
+ * Return false if q is NULL, q is not empty or has strings lent out by
+ * q_remove_head_bulk, or could not allocate space.
+ */
+bool q_set_arena(queue_t *q, bool on);
+
+/*
+ * Turn interning mode on or off.
+ * In interning mode, elements holding equal strings share a single copy,
+ * kept in a reference counted table owned by the queue, so such strings
+ * are equal exactly when their pointers are.
+ * Only available with Q_BACKEND_LIST.
+ * Return true if successful.
+ * Return false if q is NULL, q is not empty or has strings lent out by
+ * q_remove_head_bulk, or could not allocate space.
+ */
+bool q_set_intern(queue_t *q, bool on);
+
+/*
+ * Turn index mode on or off.
+ * In index mode, the queue keeps a hash table counting its strings, which
+ * insertions and removals keep up to date, so that q_contains, q_count and
+ * q_dedup take expected constant time per string rather than walking the
+ * queue.
+ * Only available with Q_BACKEND_LIST.
+ * Return true if successful.
+ * Return false if q is NULL, q is not empty or has strings lent out by
+ * q_remove_head_bulk, or could not allocate space.
+ */
+bool q_set_index(queue_t *q, bool on);
+
+/*
+ * Select the algorithm used by q_sort.
+ * Only Q_BACKEND_LIST honors it; other backends have a sort of their own.
+ * Return false if q is NULL or mode is unknown.
+ */
+bool q_set_sort_mode(queue_t *q, q_sort_mode_t mode);
+
+/*
+ * Set the number of threads the Q_SORT_PARALLEL sort may use.
+ * Queues too short to be worth splitting that far use fewer.
+ * Return false if q is NULL or threads is not in 1..Q_SORT_MAX_THREADS.
+ */
+bool q_set_sort_threads(queue_t *q, int threads);
+
 /*
  * Attempt to insert element at head of queue.
  * Return true if successful.
@@ -65,6 +204,38 @@ bool q_insert_head(queue_t *q, char *s);
  */
 bool q_insert_tail(queue_t *q, char *s);
 
+/*
+ * Like q_insert_head/q_insert_tail, for a string of len bytes at s, which
+ * need not be null-terminated.  This saves finding the length when the
+ * caller knows it already.
+ */
+bool q_insert_head_n(queue_t *q, const char *s, size_t len);
+bool q_insert_tail_n(queue_t *q, const char *s, size_t len);
+
+/*
+ * Like q_insert_head/q_insert_tail, but take over string s, which must
+ * have been allocated with malloc, instead of copying it.
+ * If successful, the queue frees s once it is removed or the queue is freed.
+ * Otherwise s still belongs to the caller.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ */
+bool q_insert_head_take(queue_t *q, char *s);
+bool q_insert_tail_take(queue_t *q, char *s);
+
+/*
+ * Attempt to insert n strings s[0] .. s[n - 1] at once.
+ * The queue ends up as after n calls of q_insert_head/q_insert_tail in that
+ * order, so with q_insert_head_bulk, s[n - 1] is at head.
+ * If len is non-NULL, s[i] is taken to be len[i] bytes long and need not be
+ * null-terminated.
+ * Either all strings are inserted or none is.
+ * Return true if successful.
+ * Return false if q is NULL, n is negative, or could not allocate space.
+ */
+bool q_insert_head_bulk(queue_t *q, char **s, const size_t *len, int n);
+bool q_insert_tail_bulk(queue_t *q, char **s, const size_t *len, int n);
+
 /*
  * Attempt to remove element from head of queue.
  * Return true if successful.
@@ -75,6 +246,54 @@ bool q_insert_tail(queue_t *q, char *s);
  */
 bool q_remove_head(queue_t *q, char *sp, size_t bufsize);
 
+/*
+ * Attempt to remove element from tail of queue, as q_remove_head does from
+ * its head.
+ * It should operate in O(1) time.
+ */
+bool q_remove_tail(queue_t *q, char *sp, size_t bufsize);
+
+/*
+ * Return the string at head/tail of queue, without removing it.
+ * It stays valid until the element is removed.
+ * Return NULL if queue is NULL or empty.
+ */
+char *q_peek_head(queue_t *q);
+char *q_peek_tail(queue_t *q);
+
+/*
+ * Remove up to k elements from head of queue, without copying.
+ * The removed strings are stored in sp[0], sp[1], ... in queue order.
+ * They stay valid until handed back to q_free_strings, or with list queues
+ * until q_free.  Other queues keep no track of them, so that those not
+ * handed back before q_free leak.
+ * Return the number of elements removed, 0 if q is NULL or empty.
+ */
+int q_remove_head_bulk(queue_t *q, char **sp, int k);
+
+/*
+ * Free n strings obtained from q_remove_head_bulk on q, in any order.
+ * Return the number of strings freed, leaving alone those of a list queue
+ * that it did not hand out, such as ones still queued.  Unless q has
+ * strings taken over or interned, each string leads straight back to its
+ * element, so passing one freed already or not from q at all is undefined.
+ */
+int q_free_strings(queue_t *q, char **sp, int n);
+
+/*
+ * Detach up to k elements from head of queue as a chain of list elements,
+ * linked through next and ending in NULL, without copying or freeing.
+ * The number of elements detached is stored in *n.
+ * The chain stays valid until handed back to q_release, which must be
+ * called before q_free.
+ * Only available with Q_BACKEND_LIST.
+ * Return NULL if q is NULL, empty, or uses another backend.
+ */
+list_ele_t *q_drain(queue_t *q, int k, int *n);
+
+/* Free a chain of elements obtained from q_drain on q */
+void q_release(queue_t *q, list_ele_t *chain);
+
 /*
  * Return number of elements in queue.
  * Return 0 if q is NULL or empty
@@ -87,6 +306,7 @@ int q_size(queue_t *q);
  * This function should not allocate or free any list elements
  * (e.g., by calling q_insert_head, q_insert_tail, or q_remove_head).
  * It should rearrange the existing ones.
+ * With Q_BACKEND_LIST and Q_BACKEND_RING, it takes O(1) time.
  */
 void q_reverse(queue_t *q);
 
@@ -97,4 +317,138 @@ void q_reverse(queue_t *q);
  */
 void q_sort(queue_t *q);
 
+/*
+ * Move the k smallest elements of queue to its head, in ascending order,
+ * in O(n log k) time.  The others follow in no particular order.
+ * Backends other than Q_BACKEND_LIST sort the whole queue instead, as does
+ * a k no less than the size of the queue.
+ * No effect if q is NULL or empty, or k <= 0.
+ */
+void q_partial_sort(queue_t *q, int k);
+
+/*
+ * Return the string that would be at index k, counting from 0 at head, if
+ * queue q were sorted, in expected O(n) time and without reordering it.
+ * It stays valid until the element is removed.
+ * Return NULL if q is NULL, k is not less than the size of q, or could not
+ * allocate space.
+ */
+char *q_select(queue_t *q, int k);
+
+/*
+ * Merge k distinct queues qs[0] .. qs[k - 1], each sorted in ascending
+ * order, into qs[0], leaving the others empty.
+ * Elements are relinked rather than copied, and equal ones keep the order
+ * of their queues in qs.  With scratch space for a heap of the k queues,
+ * this takes O(n log k) time, otherwise O(n k).
+ * Only available with Q_BACKEND_LIST, without arena, interning or index
+ * mode, as elements would outlive the arenas or tables they come from.
+ * Return the size of the merged queue.
+ * Return -1, leaving the queues as they were, if qs is NULL, k < 1, or a
+ * queue is NULL or not available for merging.
+ */
+int q_merge(queue_t **qs, int k);
+
+/*
+ * Return whether queue q holds string s.
+ * Takes expected O(1) time in index mode, otherwise O(n).
+ * Return false if q is NULL.
+ */
+bool q_contains(queue_t *q, const char *s);
+
+/*
+ * Return the number of elements of queue q holding string s.
+ * Takes expected O(1) time in index mode, otherwise O(n).
+ * Return 0 if q is NULL.
+ */
+int q_count(queue_t *q, const char *s);
+
+/*
+ * Remove the elements of queue q whose strings are also held closer to
+ * its head, so that every string is left once, where it first appeared.
+ * The queue need not be sorted.  Takes expected O(n) time, counting the
+ * strings through the index in index mode, otherwise through a table
+ * built for the occasion.
+ * Only available with Q_BACKEND_LIST.
+ * Return the number of elements removed.
+ * Return -1, leaving the queue as it was, if q is NULL or not a list
+ * queue, or could not allocate space.
+ */
+int q_dedup(queue_t *q);
+
+/*
+ * Start walking through queue q from its head.
+ * q may be NULL, which behaves like an empty queue.
+ */
+void q_iter_init(queue_t *q, q_iter_t *it);
+
+/*
+ * Return the string of the next element and advance the cursor.
+ * Return NULL once past the tail.
+ * The queue must not be modified while walking through it.
+ */
+char *q_iter_next(q_iter_t *it);
+
+/*
+ * Write a snapshot of the strings in queue q to file descriptor fd, in a
+ * compact binary form: a header giving their number and total size, then
+ * each string prefixed by its length.
+ * Return true if successful.
+ * Return false if q is NULL, a string is 4 GiB or longer, or could not
+ * write to fd.
+ */
+bool q_dump(queue_t *q, int fd);
+
+/*
+ * Read a snapshot written by q_dump from file descriptor fd, which must
+ * refer to a regular file, and insert its strings at tail of queue q, in
+ * the order they were saved.
+ * The body of the snapshot is read at once into a single buffer, then
+ * inserted as by q_insert_tail_bulk, so either all strings are inserted or
+ * none is.
+ * Return the number of strings inserted.
+ * Return -1 if q is NULL, the snapshot is malformed or cut short, its
+ * header claims more than the rest of the file holds, the queue would grow
+ * past INT_MAX elements, or could not allocate space.
+ */
+int q_load(queue_t *q, int fd);
+
+/*
+ * Turn empty queue q into a read-only view of the snapshot in file fd,
+ * written by q_dump, switching it to Q_BACKEND_MAPPED.
+ * The file is mapped into memory and its strings are handed out in place,
+ * so only an index of pointers to them is allocated.  Removal, reversal
+ * and sorting only move those pointers around; insertions fail.
+ * The file must not be truncated or rewritten until the queue is freed.
+ * Return the number of strings in the snapshot.
+ * Return -1 if q is NULL or not empty, has arena, interning or index mode
+ * on, the snapshot is malformed, or could not map the file or allocate
+ * space.
+ */
+int q_map(queue_t *q, int fd);
+
+/*
+ * Sort queue q in ascending order by way of temporary files, taking at
+ * most budget bytes of scratch space, however large the queue is.
+ * Runs of elements holding up to budget bytes of strings are cut from the
+ * head, sorted and spilled to a file, then merged back, through as many
+ * passes over the files as the buffers fitting in budget call for.
+ * The elements are relinked into q in the order merged, or if fd is not
+ * negative, the strings are written to fd as a snapshot that q_load and
+ * q_map read, freeing each element once spilled and leaving q empty.
+ * Only the budget of scratch space is bounded.  Sorting in place keeps
+ * every element in memory throughout, so it does not shrink the queue;
+ * only sorting into fd takes a queue out of memory.
+ * Equal strings keep their order.
+ * Only available with Q_BACKEND_LIST.
+ * Return the number of strings sorted.
+ * Return -1, leaving the queue as it was, if q is NULL or not a list
+ * queue, budget cannot hold a few buffers of the longest string, or could
+ * not allocate scratch space or create a spill file.  Once spilling has
+ * begun, failing to write or read a file also returns -1.  The queue then
+ * keeps all its strings, though no longer in their order, unless they were
+ * going to fd, in which case those spilled are lost.
+ */
+int q_sort_external(queue_t *q, size_t budget, int fd);
+
 #endif /* LAB0_QUEUE_H */
@@ -1,6 +1,7 @@
 #include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -158,7 +159,7 @@ static void fail_fun(char *format, char *msg)
 }
 
 /* Maximum number of megabytes that application can use (0 = unlimited) */
-static int mblimit = 0;
+int mblimit = 0;
 
 /* Keeping track of memory allocation */
 static size_t allocate_cnt = 0;
@@ -182,6 +183,30 @@ static void check_exceed(size_t new_bytes)
     }
 }
 
+/* Bytes that may still be allocated within mblimit (SIZE_MAX if unlimited) */
+size_t mem_available()
+{
+    size_t limit_bytes = (size_t) mblimit << 20;
+    if (mblimit <= 0)
+        return SIZE_MAX;
+    return limit_bytes > current_bytes ? limit_bytes - current_bytes : 0;
+}
+
+/* Count bytes allocated by other means against mblimit & exit if over */
+void mem_charge(size_t bytes)
+{
+    check_exceed(bytes);
+    current_bytes += bytes;
+    peak_bytes = MAX(peak_bytes, current_bytes);
+    last_peak_bytes = MAX(last_peak_bytes, current_bytes);
+}
+
+/* Stop counting bytes passed to mem_charge */
+void mem_release(size_t bytes)
+{
+    current_bytes -= bytes;
+}
+
 /* Call malloc & exit if fails */
 void *malloc_or_fail(size_t bytes, char *fun_name)
 {
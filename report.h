@@ -31,6 +31,21 @@ void report(int verblevel, char *fmt, ...);
 /* Like report, but without return character */
 void report_noreturn(int verblevel, char *fmt, ...);
 
+/* Maximum number of megabytes that application can use (0 = unlimited) */
+extern int mblimit;
+
+/* Bytes that may still be allocated within mblimit (SIZE_MAX if unlimited) */
+size_t mem_available();
+
+/*
+ * Count bytes allocated by other means against mblimit.  Fail when over.
+ * The bytes are counted when this is called, not while they are allocated.
+ */
+void mem_charge(size_t bytes);
+
+/* Stop counting bytes passed to mem_charge */
+void mem_release(size_t bytes);
+
 /* Attempt to call malloc.  Fail when returns NULL */
 void *malloc_or_fail(size_t bytes, char *fun_name);
 
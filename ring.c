@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+#include "ring.h"
+
+/* Capacity of a new ring.  Must be a power of 2. */
+#define RING_MIN_CAP 16
+
+/*
+ * Strings are at logical positions 0 .. count - 1, where position i lives
+ * in buf[(head + i * dir) & (cap - 1)].
+ */
+struct RING {
+    char **buf;
+    int cap;
+    int head;
+    int count;
+    int dir; /* 1, or -1 once reversed */
+};
+
+static inline int ring_index(ring_t *r, int i)
+{
+    return (r->head + i * r->dir) & (r->cap - 1);
+}
+
+/*
+ * Move contents to a new buffer of cap slots, in logical order.
+ * Return false if could not allocate space.
+ */
+static bool ring_resize(ring_t *r, int cap)
+{
+    char **buf = malloc(cap * sizeof(char *));
+    if (!buf)
+        return false;
+
+    for (int i = 0; i < r->count; i++)
+        buf[i] = r->buf[ring_index(r, i)];
+    free(r->buf);
+    r->buf = buf;
+    r->cap = cap;
+    r->head = 0;
+    r->dir = 1;
+    return true;
+}
+
+ring_t *ring_new()
+{
+    ring_t *r = malloc(sizeof(ring_t));
+    if (!r)
+        return NULL;
+
+    r->buf = malloc(RING_MIN_CAP * sizeof(char *));
+    if (!r->buf) {
+        free(r);
+        return NULL;
+    }
+    r->cap = RING_MIN_CAP;
+    r->head = 0;
+    r->count = 0;
+    r->dir = 1;
+    return r;
+}
+
+void ring_free(ring_t *r)
+{
+    if (!r)
+        return;
+
+    free(r->buf);
+    free(r);
+}
+
+bool ring_push_head(ring_t *r, char *s)
+{
+    if (r->count == r->cap && !ring_resize(r, r->cap * 2))
+        return false;
+
+    r->head = ring_index(r, -1);
+    r->buf[r->head] = s;
+    r->count++;
+    return true;
+}
+
+bool ring_push_tail(ring_t *r, char *s)
+{
+    if (r->count == r->cap && !ring_resize(r, r->cap * 2))
+        return false;
+
+    r->buf[ring_index(r, r->count)] = s;
+    r->count++;
+    return true;
+}
+
+/* Give back memory once mostly empty; keep going if that fails */
+static void ring_shrink(ring_t *r)
+{
+    if (r->cap > RING_MIN_CAP && r->count < r->cap / 4)
+        ring_resize(r, r->cap / 2);
+}
+
+char *ring_pop_head(ring_t *r)
+{
+    if (!r->count)
+        return NULL;
+
+    char *s = r->buf[r->head];
+    r->head = ring_index(r, 1);
+    r->count--;
+    ring_shrink(r);
+    return s;
+}
+
+char *ring_pop_tail(ring_t *r)
+{
+    if (!r->count)
+        return NULL;
+
+    char *s = r->buf[ring_index(r, r->count - 1)];
+    r->count--;
+    ring_shrink(r);
+    return s;
+}
+
+char *ring_peek_head(ring_t *r)
+{
+    return r->count ? r->buf[ring_index(r, 0)] : NULL;
+}
+
+char *ring_peek_tail(ring_t *r)
+{
+    return r->count ? r->buf[ring_index(r, r->count - 1)] : NULL;
+}
+
+void ring_reverse(ring_t *r)
+{
+    if (!r->count)
+        return;
+
+    r->head = ring_index(r, r->count - 1);
+    r->dir = -r->dir;
+}
+
+static void reverse_range(char **v, int lo, int hi)
+{
+    for (hi--; lo < hi; lo++, hi--) {
+        char *tmp = v[lo];
+        v[lo] = v[hi];
+        v[hi] = tmp;
+    }
+}
+
+static inline void swap_str(char **a, char **b)
+{
+    char *tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+static void sift_down(char **v, int i, int n)
+{
+    for (int c; (c = 2 * i + 1) < n; i = c) {
+        if (c + 1 < n && strcmp(v[c], v[c + 1]) < 0)
+            c++;
+        if (strcmp(v[i], v[c]) >= 0)
+            break;
+        swap_str(&v[i], &v[c]);
+    }
+}
+
+static void heap_sort(char **v, int n)
+{
+    for (int i = n / 2 - 1; i >= 0; i--)
+        sift_down(v, i, n);
+    for (int i = n - 1; i > 0; i--) {
+        swap_str(&v[0], &v[i]);
+        sift_down(v, 0, i);
+    }
+}
+
+/*
+ * Introsort: quicksort with median-of-three pivots, handing small ranges
+ * to insertion sort and falling back to heapsort when recursion gets too
+ * deep.
+ */
+static void intro_sort(char **v, int n, int depth)
+{
+    while (n > 16) {
+        if (!depth--) {
+            heap_sort(v, n);
+            return;
+        }
+
+        int mid = n / 2;
+        if (strcmp(v[mid], v[0]) < 0)
+            swap_str(&v[mid], &v[0]);
+        if (strcmp(v[n - 1], v[mid]) < 0) {
+            swap_str(&v[n - 1], &v[mid]);
+            if (strcmp(v[mid], v[0]) < 0)
+                swap_str(&v[mid], &v[0]);
+        }
+        char *pivot = v[mid];
+
+        int i = 0, j = n - 1;
+        while (i <= j) {
+            while (strcmp(v[i], pivot) < 0)
+                i++;
+            while (strcmp(v[j], pivot) > 0)
+                j--;
+            if (i <= j)
+                swap_str(&v[i++], &v[j--]);
+        }
+
+        /* Recurse into the smaller part, loop on the larger one */
+        if (j + 1 < n - i) {
+            intro_sort(v, j + 1, depth);
+            v += i;
+            n -= i;
+        } else {
+            intro_sort(v + i, n - i, depth);
+            n = j + 1;
+        }
+    }
+
+    for (int i = 1; i < n; i++) {
+        char *s = v[i];
+        int j = i;
+        for (; j > 0 && strcmp(v[j - 1], s) > 0; j--)
+            v[j] = v[j - 1];
+        v[j] = s;
+    }
+}
+
+void ring_sort(ring_t *r)
+{
+    /* Order is about to be replaced, so only the occupied slots matter */
+    int first = r->dir > 0 ? r->head : ring_index(r, r->count - 1);
+    if (first + r->count > r->cap) {
+        /* Occupied slots wrap around; rotate them to the front in place */
+        reverse_range(r->buf, 0, r->cap);
+        reverse_range(r->buf, 0, r->cap - first);
+        reverse_range(r->buf, r->cap - first, r->cap);
+        first = 0;
+    }
+
+    int depth = 0;
+    for (int n = r->count; n > 1; n >>= 1)
+        depth += 2;
+    intro_sort(r->buf + first, r->count, depth);
+    r->head = first;
+    r->dir = 1;
+}
+
+void ring_iter_init(ring_t *r, q_iter_t *it)
+{
+    it->idx = 0;
+}
+
+char *ring_iter_next(ring_t *r, q_iter_t *it)
+{
+    if (it->idx >= r->count)
+        return NULL;
+    return r->buf[ring_index(r, it->idx++)];
+}
@@ -0,0 +1,63 @@
+#ifndef LAB0_RING_H
+#define LAB0_RING_H
+
+/*
+ * Growable ring buffer used as a queue backend.
+ *
+ * String pointers are kept in one circular array, which doubles when full
+ * and halves when mostly empty.  Reversal only flips the direction in
+ * which the array is read.  The functions here only manage string
+ * pointers; the strings themselves are allocated and freed by queue.c.
+ */
+
+#include <stdbool.h>
+
+#include "queue.h"
+
+/*
+ * Create empty ring.
+ * Return NULL if could not allocate space.
+ */
+ring_t *ring_new();
+
+/*
+ * Free the storage of a ring.
+ * Strings still stored in it are not freed.
+ */
+void ring_free(ring_t *r);
+
+/*
+ * Add string pointer s at head/tail of the ring.
+ * Return false if could not allocate space.
+ */
+bool ring_push_head(ring_t *r, char *s);
+bool ring_push_tail(ring_t *r, char *s);
+
+/*
+ * Detach the string pointer at head/tail of the ring.
+ * Return NULL if the ring is empty.
+ */
+char *ring_pop_head(ring_t *r);
+char *ring_pop_tail(ring_t *r);
+
+/*
+ * Return the string pointer at head/tail of the ring, leaving it there.
+ * Return NULL if the ring is empty.
+ */
+char *ring_peek_head(ring_t *r);
+char *ring_peek_tail(ring_t *r);
+
+/* Reverse the order of strings in O(1) time */
+void ring_reverse(ring_t *r);
+
+/*
+ * Sort strings in ascending order, in place.
+ * This never calls malloc or free.
+ */
+void ring_sort(ring_t *r);
+
+/* Cursor support for q_iter_init/q_iter_next */
+void ring_iter_init(ring_t *r, q_iter_t *it);
+char *ring_iter_next(ring_t *r, q_iter_t *it);
+
+#endif /* LAB0_RING_H */
@@ -0,0 +1,161 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Strings are copied in and freed on every push and pop, so they are taken
+ * from the C library rather than the harness, whose allocations all go
+ * through one lock that would stall both sides.  The ring itself is
+ * allocated once, through the harness, which checks it is freed.
+ */
+#define INTERNAL 1
+#include "harness.h"
+#include "spsc.h"
+
+/* Size of a cache line, to keep the two sides from sharing one */
+#define CACHE_LINE 64
+
+/* Counters go up forever; slot i % cap holds string i */
+struct SPSC {
+    /* Written by the consumer */
+    atomic_size_t head;
+    size_t tail_seen; /* Consumer's copy of tail */
+    char pad_head[CACHE_LINE - 2 * sizeof(size_t)];
+
+    /* Written by the producer */
+    atomic_size_t tail;
+    size_t head_seen; /* Producer's copy of head */
+    char pad_tail[CACHE_LINE - 2 * sizeof(size_t)];
+
+    /* Read only after creation */
+    char **slot;
+    size_t mask;
+    void *block; /* Allocation the structure was aligned within */
+};
+
+spsc_t *spsc_new(size_t capacity)
+{
+    if (!capacity || capacity > SIZE_MAX / 2)
+        return NULL;
+
+    size_t cap = 1;
+    while (cap < capacity)
+        cap <<= 1;
+
+    /* Align the structure itself, so the padding above separates lines */
+    void *block = test_malloc(sizeof(spsc_t) + CACHE_LINE - 1);
+    if (!block)
+        return NULL;
+    spsc_t *r = (spsc_t *) (((uintptr_t) block + CACHE_LINE - 1) &
+                            ~(uintptr_t)(CACHE_LINE - 1));
+
+    r->slot = test_malloc(cap * sizeof(char *));
+    if (!r->slot) {
+        test_free(block);
+        return NULL;
+    }
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    r->tail_seen = 0;
+    r->head_seen = 0;
+    r->mask = cap - 1;
+    r->block = block;
+    return r;
+}
+
+void spsc_free(spsc_t *r)
+{
+    if (!r)
+        return;
+
+    size_t tail = atomic_load(&r->tail);
+    for (size_t i = atomic_load(&r->head); i != tail; i++)
+        free(r->slot[i & r->mask]);
+    test_free(r->slot);
+    test_free(r->block);
+}
+
+/* Number of free slots, as far as the producer can tell */
+static size_t room(spsc_t *r, size_t tail, size_t want)
+{
+    size_t cap = r->mask + 1;
+    if (cap - (tail - r->head_seen) < want)
+        r->head_seen = atomic_load_explicit(&r->head, memory_order_acquire);
+    return cap - (tail - r->head_seen);
+}
+
+/* Number of filled slots, as far as the consumer can tell */
+static size_t filled(spsc_t *r, size_t head, size_t want)
+{
+    if (r->tail_seen - head < want)
+        r->tail_seen = atomic_load_explicit(&r->tail, memory_order_acquire);
+    return r->tail_seen - head;
+}
+
+/* Copy string s out to sp, as q_remove_head does, and free it */
+static void copy_out(char *s, char *sp, size_t bufsize)
+{
+    if (sp && bufsize) {
+        size_t length = strnlen(s, bufsize - 1);
+        memcpy(sp, s, length);
+        sp[length] = '\0';
+    }
+    free(s);
+}
+
+bool spsc_push(spsc_t *r, const char *s)
+{
+    return spsc_push_bulk(r, &s, 1) == 1;
+}
+
+size_t spsc_push_bulk(spsc_t *r, const char *const *s, size_t n)
+{
+    if (!r)
+        return 0;
+
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t free_slots = room(r, tail, n);
+    if (n > free_slots)
+        n = free_slots;
+
+    size_t i = 0;
+    for (; i < n; i++) {
+        size_t length = strlen(s[i]) + 1;
+        char *p = malloc(length);
+        if (!p)
+            break;
+        memcpy(p, s[i], length);
+        r->slot[(tail + i) & r->mask] = p;
+    }
+
+    /* Publish the strings written above */
+    if (i)
+        atomic_store_explicit(&r->tail, tail + i, memory_order_release);
+    return i;
+}
+
+bool spsc_pop(spsc_t *r, char *sp, size_t bufsize)
+{
+    return spsc_pop_bulk(r, sp, bufsize, 1) == 1;
+}
+
+size_t spsc_pop_bulk(spsc_t *r, char *sp, size_t bufsize, size_t n)
+{
+    if (!r)
+        return 0;
+
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t ready = filled(r, head, n);
+    if (n > ready)
+        n = ready;
+
+    for (size_t i = 0; i < n; i++)
+        copy_out(r->slot[(head + i) & r->mask], sp ? sp + i * bufsize : NULL,
+                 bufsize);
+
+    /* Hand the slots back once done reading them */
+    if (n)
+        atomic_store_explicit(&r->head, head + n, memory_order_release);
+    return n;
+}
@@ -0,0 +1,66 @@
+#ifndef LAB0_SPSC_H
+#define LAB0_SPSC_H
+
+/*
+ * Bounded single-producer/single-consumer queue of strings.
+ *
+ * A ring of string pointers indexed by two free-running counters: the
+ * producer alone advances tail and the consumer alone advances head, each
+ * publishing with a release store that the other side reads with an
+ * acquire load.  The two counters live on separate cache lines, and each
+ * side keeps a private copy of the other's counter so it only has to
+ * touch the shared line when the ring looks full or empty.  No operation
+ * ever waits for the other thread.
+ *
+ * At any one time, only one thread may call the push functions and only
+ * one thread may call the pop functions.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct SPSC spsc_t;
+
+/*
+ * Create empty ring holding up to capacity strings.
+ * Capacity is rounded up to a power of 2.
+ * Return NULL if capacity is 0 or could not allocate space.
+ */
+spsc_t *spsc_new(size_t capacity);
+
+/*
+ * Free all storage used by ring, including the strings still in it.
+ * Neither thread may be using the ring any more.
+ */
+void spsc_free(spsc_t *r);
+
+/*
+ * Attempt to insert a copy of string s at tail of ring.
+ * Return false if the ring is full or could not allocate space.
+ */
+bool spsc_push(spsc_t *r, const char *s);
+
+/*
+ * Insert copies of as many as n strings of array s, as far as there is
+ * room, and make them visible to the consumer at once.
+ * Return the number of strings inserted.
+ */
+size_t spsc_push_bulk(spsc_t *r, const char *const *s, size_t n);
+
+/*
+ * Attempt to remove string from head of ring.
+ * Return false if the ring is empty.
+ * If sp is non-NULL, the removed string is copied to *sp, as by
+ * q_remove_head.
+ */
+bool spsc_pop(spsc_t *r, char *sp, size_t bufsize);
+
+/*
+ * Remove as many as n strings from head of ring, releasing their slots to
+ * the producer at once.  If sp is non-NULL, the i-th string is copied to
+ * the buffer at sp + i * bufsize.
+ * Return the number of strings removed.
+ */
+size_t spsc_pop_bulk(spsc_t *r, char *sp, size_t bufsize, size_t n);
+
+#endif /* LAB0_SPSC_H */
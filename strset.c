@@ -0,0 +1,169 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+#include "strset.h"
+
+/* Slots in a new table.  It doubles whenever more than half are taken. */
+#define STRSET_MIN_SLOTS 64
+
+typedef struct {
+    size_t count;
+    size_t length;
+    char str[];
+} member_t;
+
+typedef struct {
+    uint64_t hash;
+    member_t *m; /* NULL if the slot is free */
+} slot_t;
+
+struct STRSET {
+    slot_t *slot;
+    size_t mask; /* Number of slots - 1 */
+    size_t used; /* Slots holding members */
+};
+
+/* 64-bit FNV-1a */
+static uint64_t hash_str(const char *s, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) s[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/* Allocate n free slots */
+static slot_t *slot_new(size_t n)
+{
+    slot_t *slot = malloc(n * sizeof(slot_t));
+    if (slot)
+        memset(slot, 0, n * sizeof(slot_t));
+    return slot;
+}
+
+strset_t *strset_new()
+{
+    strset_t *t = malloc(sizeof(strset_t));
+    if (!t)
+        return NULL;
+
+    t->slot = slot_new(STRSET_MIN_SLOTS);
+    if (!t->slot) {
+        free(t);
+        return NULL;
+    }
+    t->mask = STRSET_MIN_SLOTS - 1;
+    t->used = 0;
+    return t;
+}
+
+/*
+ * Return the slot holding string s of length len and hash h, or the free
+ * slot that ends its probe sequence if s is not held.
+ */
+static size_t find(const strset_t *t, const char *s, size_t len, uint64_t h)
+{
+    size_t i = h & t->mask;
+    for (; t->slot[i].m; i = (i + 1) & t->mask) {
+        const member_t *m = t->slot[i].m;
+        if (t->slot[i].hash == h && m->length == len &&
+            !memcmp(m->str, s, len))
+            break;
+    }
+    return i;
+}
+
+/* Double the number of slots.  Return false if out of space. */
+static bool grow(strset_t *t)
+{
+    size_t n = (t->mask + 1) * 2;
+    slot_t *slot = slot_new(n);
+    if (!slot)
+        return false;
+
+    for (size_t i = 0; i <= t->mask; i++) {
+        if (!t->slot[i].m)
+            continue;
+        size_t j = t->slot[i].hash & (n - 1);
+        while (slot[j].m)
+            j = (j + 1) & (n - 1);
+        slot[j] = t->slot[i];
+    }
+    free(t->slot);
+    t->slot = slot;
+    t->mask = n - 1;
+    return true;
+}
+
+bool strset_add(strset_t *t, const char *s, size_t len)
+{
+    uint64_t h = hash_str(s, len);
+    size_t i = find(t, s, len, h);
+    if (t->slot[i].m) {
+        t->slot[i].m->count++;
+        return true;
+    }
+
+    /* Keep at least one slot free, even if the table cannot grow */
+    if (2 * (t->used + 1) > t->mask + 1) {
+        if (grow(t))
+            i = find(t, s, len, h);
+        else if (t->used + 1 > t->mask)
+            return false;
+    }
+
+    member_t *m = malloc(sizeof(member_t) + len + 1);
+    if (!m)
+        return false;
+
+    memcpy(m->str, s, len);
+    m->str[len] = '\0';
+    m->count = 1;
+    m->length = len;
+    t->slot[i].hash = h;
+    t->slot[i].m = m;
+    t->used++;
+    return true;
+}
+
+void strset_remove(strset_t *t, const char *s, size_t len)
+{
+    size_t i = find(t, s, len, hash_str(s, len));
+    if (--t->slot[i].m->count)
+        return;
+
+    free(t->slot[i].m);
+    /* Close the gap by moving back later slots of the same probe run
+     * whose probe sequences pass through it, so no tombstones are needed.
+     */
+    for (size_t j = (i + 1) & t->mask; t->slot[j].m; j = (j + 1) & t->mask) {
+        size_t home = t->slot[j].hash & t->mask;
+        if (((j - home) & t->mask) >= ((j - i) & t->mask)) {
+            t->slot[i] = t->slot[j];
+            i = j;
+        }
+    }
+    t->slot[i].m = NULL;
+    t->used--;
+}
+
+size_t strset_count(strset_t *t, const char *s, size_t len)
+{
+    size_t i = find(t, s, len, hash_str(s, len));
+    return t->slot[i].m ? t->slot[i].m->count : 0;
+}
+
+void strset_free(strset_t *t)
+{
+    if (!t)
+        return;
+
+    for (size_t i = 0; i <= t->mask; i++)
+        free(t->slot[i].m);
+    free(t->slot);
+    free(t);
+}
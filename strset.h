@@ -0,0 +1,42 @@
+#ifndef LAB0_STRSET_H
+#define LAB0_STRSET_H
+
+/*
+ * Multiset of strings, counting how many times each one is held.
+ *
+ * Strings are found by open addressing with linear probing, in a table of
+ * slots that cache their hashes, so that probes past other strings rarely
+ * need to look at them.  Each distinct string is copied once, along with
+ * its count, and freed once the count drops to zero.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct STRSET strset_t;
+
+/*
+ * Create empty set.
+ * Return NULL if could not allocate space.
+ */
+strset_t *strset_new();
+
+/*
+ * Count one more of the first len bytes of string s.
+ * Return false if could not allocate space.
+ */
+bool strset_add(strset_t *t, const char *s, size_t len);
+
+/* Count one less of the first len bytes of string s, which must be held */
+void strset_remove(strset_t *t, const char *s, size_t len);
+
+/* Return how many of the first len bytes of string s are held */
+size_t strset_count(strset_t *t, const char *s, size_t len);
+
+/*
+ * Free ALL storage used by the set.
+ * No effect if t is NULL
+ */
+void strset_free(strset_t *t);
+
+#endif /* LAB0_STRSET_H */
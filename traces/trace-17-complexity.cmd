@@ -1,5 +1,6 @@
-# Test if q_insert_tail and q_size is constant time complexity
+# Test if q_insert_tail, q_size and q_reverse is constant time complexity
 option simulation 1
 it
 size
+reverse
 option simulation 0
@@ -0,0 +1,27 @@
+# Test of queue operations with elements allocated from an arena
+option fail 0
+option malloc 0
+option backend 0
+option arena 1
+new
+ih gerbil
+it bear
+ih dolphin
+rh dolphin
+rh gerbil
+it meerkat
+ih a_string_that_is_long_enough_to_spill_out_of_the_regular_size_classes_of_the_arena_and_needs_a_dedicated_slab_so_we_can_check_that_it_is_released_properly_when_it_is_removed_from_the_queue_while_the_rest_of_the_elements_stay_around_until_the_queue_is_freed_as_a_whole_0123456789_0123456789_0123456789_0123456789_0123456789_0123456789_0123456789_0123456789_0123456789_0123456789_0123456789_0123456789_0123456789_0123456789_abcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghijabcdefghij
+rhq
+it vulture 100000
+reverse
+sort
+rh bear
+size
+free
+new
+option fail 30
+option malloc 25
+ih jaguar 1000
+it squirrel 1000
+rhq
+free
@@ -0,0 +1,28 @@
+# Test of queue operations on the unrolled list backend
+option fail 0
+option malloc 0
+option backend 1
+new
+ih gerbil
+ih bear
+it dolphin
+it meerkat 40
+ih vulture 40
+reverse
+rh meerkat
+sort
+rh bear
+rh dolphin
+rh gerbil
+it aardvark
+reverse
+rh aardvark
+size
+free
+new
+it squirrel 100000
+ih jaguar 100000
+sort
+rh jaguar
+size
+free
@@ -0,0 +1,32 @@
+# Test of queue operations on the ring buffer backend
+option fail 0
+option malloc 0
+option backend 2
+new
+ih gerbil
+ih bear
+it dolphin
+reverse
+ih meerkat
+it vulture
+rh meerkat
+rh dolphin
+sort
+rh bear
+it aardvark 100
+ih jaguar 100
+reverse
+rh aardvark
+sort
+rh aardvark
+size
+free
+new
+it squirrel 100000
+ih jaguar 100000
+reverse
+sort
+rh jaguar
+rhq
+size
+free
@@ -0,0 +1,104 @@
+# Test of sort with each list sorting algorithm, serial and parallel
+option fail 0
+option malloc 0
+option backend 0
+option sortmode 1
+new
+it bear
+it dolphin
+it gerbil
+it meerkat
+sort
+rh bear
+it aardvark
+sort
+rh aardvark
+reverse
+sort
+rh dolphin
+ih zebra
+ih vulture
+ih squirrel
+it jaguar
+it bear
+it cat
+sort
+rh bear
+rh cat
+rh gerbil
+rh jaguar
+rh meerkat
+rh squirrel
+rh vulture
+rh zebra
+it dolphin 100000
+ih gerbil 100000
+it aardvark 100000
+sort
+rh aardvark
+reverse
+sort
+rh aardvark
+free
+option sortmode 2
+new
+it /var/log/app/2020-10-01/worker-17 20
+it /var/log/app/2020-10-01/worker-3 20
+it /var/log/app/2020-09-30/worker-3 20
+ih /var/log/app/2020-10-01 20
+ih /var/log/app/2020-10-01/worker-170 20
+ih /var/cache 5
+sort
+rh /var/cache
+rhq
+rhq
+rhq
+rhq
+rh /var/log/app/2020-09-30/worker-3
+it dolphin 100000
+ih gerbil 100000
+it aardvark 100000
+sort
+rh /var/log/app/2020-09-30/worker-3
+free
+option sortmode 3
+option sortthreads 3
+new
+it dolphin 10000
+ih gerbil 10000
+it aardvark 10000
+ih meerkat
+it bear
+sort
+rh aardvark
+reverse
+sort
+rh aardvark
+option sortthreads 1
+sort
+rh aardvark
+free
+option sortmode 4
+new
+it dolphin 10000
+ih gerbil 10000
+it aardvark 10000
+ih meerkat
+it bear
+reverse
+sort
+rh aardvark
+rt meerkat
+reverse
+sort
+rh aardvark
+ih /var/log/app/2020-10-01/worker-17 20
+ih /var/log/app/2020-10-01/worker-3 20
+option malloc 50
+sort
+sort
+sort
+option malloc 0
+rh /var/log/app/2020-10-01/worker-17
+rt gerbil
+free
@@ -0,0 +1,7 @@
+# Test of the lock-free queue with concurrent producers and consumers
+option fail 0
+option malloc 0
+mpmc 1 1 20000
+mpmc 4 4 10000
+mpmc 7 2 5000
+mpmc 2 7 5000
@@ -0,0 +1,6 @@
+# Test of the single-producer/single-consumer ring, one and many at a time
+option fail 0
+option malloc 0
+spsc 100000
+spsc 100000 16
+spsc 20000 1024
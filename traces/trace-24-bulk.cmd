@@ -0,0 +1,49 @@
+# Test of bulk insertion and removal on each backend
+option fail 30
+option malloc 0
+option backend 0
+new
+ih dolphin 3
+it gerbil 3
+rh dolphin
+rhb 4
+rh gerbil
+it bear 5000
+ih meerkat 2000
+rhb 1999
+rh meerkat
+drain 4990
+rh bear
+drain
+size
+option malloc 25
+ih jaguar 20
+it squirrel 20
+option malloc 0
+rhb
+free
+option arena 1
+new
+it vulture 3000
+drain 2999
+rh vulture
+it zebra 4
+rhb 2
+free
+option arena 0
+option backend 1
+new
+it dolphin 100
+ih gerbil 100
+rhb 150
+rh dolphin
+rhb
+free
+option backend 2
+new
+ih dolphin 100
+it gerbil 100
+rhb 150
+rh gerbil
+rhb
+free
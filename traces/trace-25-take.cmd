@@ -0,0 +1,52 @@
+# Test of handing strings over to the queue without copying
+option fail 30
+option malloc 0
+option backend 0
+new
+iht dolphin
+itt bear 3
+ih gerbil
+rh gerbil
+rh dolphin
+iht RAND 20
+rhb 10
+sort
+reverse
+free
+new
+itt zebra 100
+iht meerkat 100
+it vulture 100
+drain 150
+sort
+rhb
+free
+option arena 1
+new
+itt jaguar 10
+iht squirrel 10
+rh squirrel
+rhb 5
+drain 4
+free
+option arena 0
+option malloc 25
+new
+iht cheetah 4
+itt lion 4
+free
+option malloc 0
+option backend 1
+new
+itt dolphin 100
+iht gerbil 100
+rh gerbil
+rhb 150
+free
+option backend 2
+new
+iht dolphin 100
+itt gerbil 100
+rhb 150
+rh gerbil
+free
@@ -0,0 +1,44 @@
+# Test of sharing equal strings in interning mode
+option fail 30
+option malloc 0
+option intern 1
+new
+ih dolphin 3
+it bear 3
+rh dolphin
+iht bear 2
+itt dolphin 2
+sort
+rh bear
+rh bear
+reverse
+rh dolphin
+rhb 3
+drain 2
+size
+ih RAND 50
+it gerbil 2000
+sort
+rhb 1000
+free
+option arena 1
+new
+it vulture 100
+ih meerkat 100
+iht vulture 10
+rh vulture
+rhb 50
+drain 20
+sort
+free
+option arena 0
+option malloc 25
+new
+ih jaguar 10
+it squirrel 10
+iht jaguar 4
+option malloc 0
+rhb
+free
+option intern 0
+intern 20000 50
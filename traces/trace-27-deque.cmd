@@ -0,0 +1,61 @@
+# Test of removing from tail and peeking at both ends
+option fail 10
+option malloc 0
+option backend 0
+new
+peek
+rt
+it dolphin
+peek
+ih bear
+it gerbil
+peek
+rt gerbil
+rt dolphin
+rt bear
+it meerkat 3
+ih jaguar 3
+reverse
+rt jaguar
+rh meerkat
+sort
+peek
+rt meerkat
+rh jaguar
+it vulture 2000
+ih squirrel 2000
+rhb 1500
+rt vulture
+drain 1000
+peek
+rt vulture
+free
+option arena 1
+new
+ih dolphin 100
+it bear 100
+sort
+rt dolphin
+reverse
+rt bear
+peek
+free
+option arena 0
+option backend 1
+new
+it dolphin 100
+ih bear 100
+rt dolphin
+reverse
+rt bear
+peek
+free
+option backend 2
+new
+it dolphin 100
+ih bear 100
+rt dolphin
+reverse
+rt bear
+peek
+free
@@ -0,0 +1,71 @@
+# Test of saving queues to a file and loading them back
+option fail 10
+option malloc 0
+option backend 0
+new
+ih dolphin
+ih bear
+it gerbil
+it meerkat 3
+reverse
+save /tmp/lab0-trace-28.bin
+free
+new
+load /tmp/lab0-trace-28.bin
+rh meerkat
+rh meerkat
+rh meerkat
+rh gerbil
+rh dolphin
+rh bear
+load /tmp/lab0-trace-28.bin
+load /tmp/lab0-trace-28.bin
+size
+rt bear
+rt dolphin
+rt gerbil
+free
+option intern 1
+new
+it squirrel 1000
+save /tmp/lab0-trace-28.bin
+it vulture
+load /tmp/lab0-trace-28.bin
+rh squirrel
+rt squirrel
+free
+option intern 0
+option backend 1
+new
+ih jaguar 500
+load /tmp/lab0-trace-28.bin
+rh jaguar
+rt squirrel
+save /tmp/lab0-trace-28.bin
+free
+option backend 2
+new
+load /tmp/lab0-trace-28.bin
+rh jaguar
+rt squirrel
+free
+new
+save /tmp/lab0-trace-28.bin
+load /tmp/lab0-trace-28.bin
+load traces/trace-28-snapshot.cmd
+# Header claiming a terabyte of strings in a 30-byte file
+load traces/trace-28-corrupt.bin
+size
+free
+option backend 0
+option arena 1
+new
+it gerbil 200
+save /tmp/lab0-trace-28.bin
+option malloc 10
+load /tmp/lab0-trace-28.bin
+load /tmp/lab0-trace-28.bin
+load /tmp/lab0-trace-28.bin
+option malloc 0
+rt gerbil
+free
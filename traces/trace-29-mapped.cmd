@@ -0,0 +1,47 @@
+# Test of read-only queues mapped from snapshot files
+option fail 10
+option malloc 0
+option backend 0
+new
+it gerbil 3
+ih dolphin
+it bear
+ih meerkat 2
+save /tmp/lab0-trace-29.bin
+free
+mapload /tmp/lab0-trace-29.bin
+size
+peek
+rh meerkat
+rt bear
+it squirrel
+ih vulture
+reverse
+rh gerbil
+sort
+rh dolphin
+rt meerkat
+rhb 1
+size
+save /tmp/lab0-trace-29-copy.bin
+free
+mapload /tmp/lab0-trace-29-copy.bin
+rh gerbil
+free
+new
+it RAND 50000
+save /tmp/lab0-trace-29.bin
+free
+mapload /tmp/lab0-trace-29.bin
+sort
+reverse
+rhb 20000
+size
+new
+mapload traces/trace-29-mapped.cmd
+new
+save /tmp/lab0-trace-29.bin
+mapload /tmp/lab0-trace-29.bin
+size
+rh
+free
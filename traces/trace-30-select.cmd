@@ -0,0 +1,66 @@
+# Test of partial sort and selection of elements in sorted order
+option fail 10
+option malloc 0
+option backend 0
+new
+nth 0
+topk 3
+it meerkat
+it dolphin
+it gerbil
+it bear
+it vulture
+ih aardvark
+it squirrel
+nth 0
+nth 3
+nth 6
+nth 7
+topk 3
+rh aardvark
+rh bear
+rh dolphin
+topk 0
+rt squirrel
+reverse
+topk 2
+rh gerbil
+rh meerkat
+rt vulture
+it gerbil 1000
+it jaguar 1000
+ih dolphin 1000
+it zebra
+ih aardvark
+nth 1000
+nth 2001
+topk 100
+rh aardvark
+nth 500
+reverse
+topk 5000
+rt zebra
+option malloc 30
+nth 500
+topk 20
+nth 10
+topk 30
+option malloc 0
+free
+option backend 2
+new
+it meerkat
+ih dolphin
+it gerbil
+ih bear
+nth 2
+topk 1
+rh bear
+rt meerkat
+free
+option backend 0
+new
+it RAND 50000
+time topk 10
+time nth 25000
+free
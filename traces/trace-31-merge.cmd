@@ -0,0 +1,95 @@
+# Test of merging sorted queues, switching between named queues
+option fail 10
+option malloc 0
+option backend 0
+new
+it bear
+it gerbil
+it vulture
+use b
+new
+it aardvark
+it dolphin
+it gerbil
+it zebra
+use c
+new
+ih squirrel
+ih meerkat
+ih cat
+use d
+new
+use main
+merge b c d
+size
+rh aardvark
+rh bear
+rh cat
+rh dolphin
+rh gerbil
+rh gerbil
+rt zebra
+use b
+size
+it jaguar 3
+use c
+new
+it jaguar
+it meerkat 2
+reverse
+sort
+use b
+merge c
+rh jaguar
+rt meerkat
+use main
+merge b
+rh jaguar
+rh jaguar
+rh jaguar
+rh meerkat
+rt vulture
+free
+use b
+free
+use c
+free
+use d
+free
+use e
+option backend 2
+new
+it bear
+use f
+option backend 0
+new
+it cat
+merge e
+free
+use e
+free
+use main
+new
+it dolphin 10000
+it gerbil 10000
+use g
+new
+it bear 20000
+it meerkat 10000
+reverse
+sort
+use h
+new
+ih jaguar 5000
+use main
+option malloc 90
+merge g h
+option malloc 0
+rh bear
+rt meerkat
+size
+free
+use g
+free
+use h
+free
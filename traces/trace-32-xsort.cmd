@@ -0,0 +1,39 @@
+# Test of external sort through temporary files, within a memory limit
+option fail 10
+option malloc 0
+option backend 0
+option sortmem 16
+new
+ih dolphin 2000
+ih RAND 20000
+it Aardvark
+ih ~zebra 500
+reverse
+xsort
+rh Aardvark
+rt ~zebra
+rt ~zebra
+# Too little memory for even a few buffers
+option sortmem 8
+xsort
+size
+# Stream into a snapshot, capped by mblimit rather than sortmem
+option sortmem 4096
+option mblimit 1
+xsort /tmp/lab0-trace-32.bin
+size
+mapload /tmp/lab0-trace-32.bin
+rh
+rt ~zebra
+free
+option intern 1
+option sortmem 16
+new
+ih kangaroo 3000
+it Aardvark
+ih RAND 5000
+ih Zebu 10
+xsort
+rh Aardvark
+rh Zebu
+free
@@ -0,0 +1,72 @@
+# Test of find, count and dedup, with and without a hash index
+option fail 10
+option malloc 0
+option backend 0
+new
+ih gerbil
+it bear
+it dolphin
+ih bear
+it gerbil
+it bear
+find bear
+find meerkat
+count bear
+count gerbil
+count meerkat
+dedup
+rh bear
+rh gerbil
+rh dolphin
+size
+free
+option index 1
+new
+ih gerbil
+it bear
+it dolphin
+ih bear
+it gerbil
+it bear
+find bear
+count bear
+find meerkat
+rh bear
+rt bear
+count bear
+reverse
+it vulture
+ih gerbil
+count gerbil
+dedup
+rh gerbil
+rh dolphin
+rh bear
+rh vulture
+count gerbil
+find dolphin
+# Bulk and taken strings are counted too
+iht ant 3
+itt ant 2
+count ant
+rhb 2
+count ant
+save /tmp/lab0-trace-33.bin
+load /tmp/lab0-trace-33.bin
+count ant
+option sortmem 16
+xsort
+count ant
+dedup
+count ant
+free
+option intern 1
+new
+ih RAND 1000
+it kangaroo 20
+ih kangaroo 5
+count kangaroo
+dedup
+count kangaroo
+rhq
+free
@@ -0,0 +1,14 @@
+# Test performance of find, count and dedup on a million strings in index mode
+option fail 0
+option malloc 0
+option index 1
+new
+ih dolphin 500000
+ih RAND 500000
+it gerbil
+find gerbil 1000000
+count dolphin 1000000
+find meerkat 1000000
+dedup
+count dolphin 1000000
+free
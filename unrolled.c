@@ -0,0 +1,310 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+#include "unrolled.h"
+
+/*
+ * Chunks kept in reserve for unrolled_sort, which merges runs of chunks
+ * into chunks taken from the spare pool and may need two more chunks than
+ * it has released so far.
+ */
+#define UNROLLED_RESERVE 2
+
+/* Chunk holding strings in slot[first] .. slot[last - 1] */
+typedef struct CHUNK {
+    struct CHUNK *next, *prev;
+    int first, last;
+    char *slot[UNROLLED_SLOTS];
+} chunk_t;
+
+struct UNROLLED {
+    chunk_t *head, *tail;
+    chunk_t *spare; /* Empty chunks, linked through next */
+    int nspare;
+};
+
+static void spare_put(unrolled_t *u, chunk_t *c)
+{
+    c->next = u->spare;
+    u->spare = c;
+    u->nspare++;
+}
+
+static chunk_t *spare_get(unrolled_t *u)
+{
+    chunk_t *c = u->spare;
+    u->spare = c->next;
+    u->nspare--;
+    return c;
+}
+
+/* Get an empty chunk, preferably one from the spare pool */
+static chunk_t *chunk_get(unrolled_t *u)
+{
+    if (u->nspare > UNROLLED_RESERVE)
+        return spare_get(u);
+    return malloc(sizeof(chunk_t));
+}
+
+/* Dispose of an empty chunk, keeping a few around to avoid thrashing */
+static void chunk_put(unrolled_t *u, chunk_t *c)
+{
+    if (u->nspare > UNROLLED_RESERVE)
+        free(c);
+    else
+        spare_put(u, c);
+}
+
+unrolled_t *unrolled_new()
+{
+    unrolled_t *u = malloc(sizeof(unrolled_t));
+    if (!u)
+        return NULL;
+
+    u->head = u->tail = NULL;
+    u->spare = NULL;
+    u->nspare = 0;
+    for (int i = 0; i <= UNROLLED_RESERVE; i++) {
+        chunk_t *c = malloc(sizeof(chunk_t));
+        if (!c) {
+            unrolled_free(u);
+            return NULL;
+        }
+        spare_put(u, c);
+    }
+    return u;
+}
+
+void unrolled_free(unrolled_t *u)
+{
+    if (!u)
+        return;
+
+    while (u->head) {
+        chunk_t *c = u->head;
+        u->head = c->next;
+        free(c);
+    }
+    while (u->spare)
+        free(spare_get(u));
+    free(u);
+}
+
+bool unrolled_push_head(unrolled_t *u, char *s)
+{
+    chunk_t *c = u->head;
+    if (!c || c->first == 0) {
+        c = chunk_get(u);
+        if (!c)
+            return false;
+        /* A lone chunk starts in the middle so it can grow both ways */
+        c->first = c->last = u->head ? UNROLLED_SLOTS : UNROLLED_SLOTS / 2;
+        c->prev = NULL;
+        c->next = u->head;
+        if (u->head)
+            u->head->prev = c;
+        else
+            u->tail = c;
+        u->head = c;
+    }
+    c->slot[--c->first] = s;
+    return true;
+}
+
+bool unrolled_push_tail(unrolled_t *u, char *s)
+{
+    chunk_t *c = u->tail;
+    if (!c || c->last == UNROLLED_SLOTS) {
+        c = chunk_get(u);
+        if (!c)
+            return false;
+        c->first = c->last = u->tail ? 0 : UNROLLED_SLOTS / 2;
+        c->next = NULL;
+        c->prev = u->tail;
+        if (u->tail)
+            u->tail->next = c;
+        else
+            u->head = c;
+        u->tail = c;
+    }
+    c->slot[c->last++] = s;
+    return true;
+}
+
+char *unrolled_pop_head(unrolled_t *u)
+{
+    chunk_t *c = u->head;
+    if (!c)
+        return NULL;
+
+    char *s = c->slot[c->first++];
+    if (c->first == c->last) {
+        u->head = c->next;
+        if (u->head)
+            u->head->prev = NULL;
+        else
+            u->tail = NULL;
+        chunk_put(u, c);
+    }
+    return s;
+}
+
+char *unrolled_pop_tail(unrolled_t *u)
+{
+    chunk_t *c = u->tail;
+    if (!c)
+        return NULL;
+
+    char *s = c->slot[--c->last];
+    if (c->first == c->last) {
+        u->tail = c->prev;
+        if (u->tail)
+            u->tail->next = NULL;
+        else
+            u->head = NULL;
+        chunk_put(u, c);
+    }
+    return s;
+}
+
+char *unrolled_peek_head(unrolled_t *u)
+{
+    return u->head ? u->head->slot[u->head->first] : NULL;
+}
+
+char *unrolled_peek_tail(unrolled_t *u)
+{
+    return u->tail ? u->tail->slot[u->tail->last - 1] : NULL;
+}
+
+void unrolled_reverse(unrolled_t *u)
+{
+    chunk_t *c = u->head;
+    u->head = u->tail;
+    u->tail = c;
+
+    while (c) {
+        chunk_t *next = c->next;
+        c->next = c->prev;
+        c->prev = next;
+
+        /* Mirror the used slots within the chunk */
+        for (int i = c->first, j = c->last - 1; i < j; i++, j--) {
+            char *tmp = c->slot[i];
+            c->slot[i] = c->slot[j];
+            c->slot[j] = tmp;
+        }
+        int first = UNROLLED_SLOTS - c->last;
+        c->last = UNROLLED_SLOTS - c->first;
+        c->first = first;
+        memmove(&c->slot[first], &c->slot[UNROLLED_SLOTS - c->last],
+                (c->last - first) * sizeof(char *));
+        c = next;
+    }
+}
+
+/* Sort the used slots of a single chunk with insertion sort */
+static void chunk_sort(chunk_t *c)
+{
+    for (int i = c->first + 1; i < c->last; i++) {
+        char *s = c->slot[i];
+        int j = i;
+        for (; j > c->first && strcmp(c->slot[j - 1], s) > 0; j--)
+            c->slot[j] = c->slot[j - 1];
+        c->slot[j] = s;
+    }
+}
+
+/*
+ * Merge sorted runs a and b, each a NULL-terminated chain of chunks.
+ * Output goes to chunks from the spare pool, and each input chunk is
+ * returned to the pool as soon as it has been consumed.  At any point
+ * the output needs at most two chunks more than the input has given
+ * back, which is what UNROLLED_RESERVE accounts for.
+ */
+static chunk_t *merge_runs(unrolled_t *u, chunk_t *a, chunk_t *b)
+{
+    chunk_t *head = NULL, *out = NULL;
+
+    while (a || b) {
+        chunk_t **src =
+            !b || (a && strcmp(a->slot[a->first], b->slot[b->first]) <= 0)
+                ? &a
+                : &b;
+        chunk_t *c = *src;
+        char *s = c->slot[c->first++];
+        if (c->first == c->last) {
+            *src = c->next;
+            spare_put(u, c);
+        }
+
+        if (!out || out->last == UNROLLED_SLOTS) {
+            chunk_t *n = spare_get(u);
+            n->first = n->last = 0;
+            n->next = NULL;
+            if (out)
+                out->next = n;
+            else
+                head = n;
+            out = n;
+        }
+        out->slot[out->last++] = s;
+    }
+    return head;
+}
+
+void unrolled_sort(unrolled_t *u)
+{
+    /* pending[i] is a sorted run built from 2^i chunks, or NULL */
+    chunk_t *pending[64] = {NULL};
+
+    chunk_t *c = u->head;
+    while (c) {
+        chunk_t *run = c;
+        c = c->next;
+        run->next = NULL;
+        chunk_sort(run);
+
+        int i = 0;
+        for (; pending[i]; i++) {
+            run = merge_runs(u, pending[i], run);
+            pending[i] = NULL;
+        }
+        pending[i] = run;
+    }
+
+    /* Lower levels hold later elements, so merge them in from the right */
+    chunk_t *list = NULL;
+    for (int i = 0; i < 64; i++) {
+        if (pending[i])
+            list = list ? merge_runs(u, pending[i], list) : pending[i];
+    }
+
+    u->head = list;
+    u->tail = NULL;
+    for (c = list; c; c = c->next) {
+        c->prev = u->tail;
+        u->tail = c;
+    }
+}
+
+void unrolled_iter_init(unrolled_t *u, q_iter_t *it)
+{
+    it->node = u->head;
+    it->idx = u->head ? u->head->first : 0;
+}
+
+char *unrolled_iter_next(q_iter_t *it)
+{
+    chunk_t *c = it->node;
+    if (!c)
+        return NULL;
+
+    char *s = c->slot[it->idx++];
+    if (it->idx == c->last) {
+        it->node = c->next;
+        it->idx = c->next ? c->next->first : 0;
+    }
+    return s;
+}
@@ -0,0 +1,67 @@
+#ifndef LAB0_UNROLLED_H
+#define LAB0_UNROLLED_H
+
+/*
+ * Unrolled linked list used as a queue backend.
+ *
+ * Strings are kept in chunks of UNROLLED_SLOTS pointers each, so walking
+ * the queue touches one chunk per UNROLLED_SLOTS elements instead of one
+ * node per element.  The functions here only manage string pointers; the
+ * strings themselves are allocated and freed by queue.c.
+ */
+
+#include <stdbool.h>
+
+#include "queue.h"
+
+/* Number of string slots in a chunk */
+#define UNROLLED_SLOTS 32
+
+/*
+ * Create empty unrolled list.
+ * Return NULL if could not allocate space.
+ */
+unrolled_t *unrolled_new();
+
+/*
+ * Free the chunks of an unrolled list.
+ * Strings still stored in it are not freed.
+ */
+void unrolled_free(unrolled_t *u);
+
+/*
+ * Add string pointer s at head/tail of the list.
+ * Return false if could not allocate space.
+ */
+bool unrolled_push_head(unrolled_t *u, char *s);
+bool unrolled_push_tail(unrolled_t *u, char *s);
+
+/*
+ * Detach the string pointer at head/tail of the list.
+ * Return NULL if the list is empty.
+ */
+char *unrolled_pop_head(unrolled_t *u);
+char *unrolled_pop_tail(unrolled_t *u);
+
+/*
+ * Return the string pointer at head/tail of the list, leaving it there.
+ * Return NULL if the list is empty.
+ */
+char *unrolled_peek_head(unrolled_t *u);
+char *unrolled_peek_tail(unrolled_t *u);
+
+/* Reverse the order of strings in place */
+void unrolled_reverse(unrolled_t *u);
+
+/*
+ * Sort strings in ascending order.
+ * Only chunks already owned by the list are used, so this never calls
+ * malloc or free.
+ */
+void unrolled_sort(unrolled_t *u);
+
+/* Cursor support for q_iter_init/q_iter_next */
+void unrolled_iter_init(unrolled_t *u, q_iter_t *it);
+char *unrolled_iter_next(q_iter_t *it);
+
+#endif /* LAB0_UNROLLED_H */